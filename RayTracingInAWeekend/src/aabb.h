@@ -0,0 +1,106 @@
+#ifndef AABB_H
+#define AABB_H
+
+#include "common.h"
+
+#include <utility>
+
+class aabb
+{
+public:
+	interval x, y, z;
+
+	aabb()
+	{
+		// The default AABB is empty, since intervals are empty by default.
+	}
+
+	aabb(const interval& ix, const interval& iy, const interval& iz)
+		: x(ix), y(iy), z(iz)
+	{
+
+	}
+
+	aabb(const point3& a, const point3& b)
+	{
+		// Treat the two points a and b as extrema for the bounding box, so we don't require a
+		// particular minimum/maximum coordinate order.
+		x = interval(fmin(a[0], b[0]), fmax(a[0], b[0]));
+		y = interval(fmin(a[1], b[1]), fmax(a[1], b[1]));
+		z = interval(fmin(a[2], b[2]), fmax(a[2], b[2]));
+	}
+
+	aabb(const aabb& box0, const aabb& box1)
+		: x(box0.x, box1.x), y(box0.y, box1.y), z(box0.z, box1.z)
+	{
+
+	}
+
+	const interval& axis(int n) const
+	{
+		if (n == 1) return y;
+		if (n == 2) return z;
+		return x;
+	}
+
+	bool is_empty() const
+	{
+		return x.min > x.max || y.min > y.max || z.min > z.max;
+	}
+
+	point3 centroid() const
+	{
+		return point3((x.min + x.max) / 2, (y.min + y.max) / 2, (z.min + z.max) / 2);
+	}
+
+	int longest_axis() const
+	{
+		if (x.size() > y.size())
+			return x.size() > z.size() ? 0 : 2;
+		return y.size() > z.size() ? 1 : 2;
+	}
+
+	double surface_area() const
+	{
+		if (is_empty())
+			return 0;
+		auto dx = x.size(), dy = y.size(), dz = z.size();
+		return 2 * (dx * dy + dy * dz + dz * dx);
+	}
+
+	bool hit(const ray& r, interval ray_t) const
+	{
+		vec3 dir = r.direction();
+		return hit(r.origin(), vec3(1 / dir[0], 1 / dir[1], 1 / dir[2]), ray_t);
+	}
+
+	bool hit(const point3& origin, const vec3& inv_dir, interval ray_t) const
+	{
+		double t_enter;
+		return hit(origin, inv_dir, ray_t, t_enter);
+	}
+
+	bool hit(const point3& origin, const vec3& inv_dir, interval ray_t, double& t_enter) const
+	{
+		// Slab test with a precomputed reciprocal direction, so traversal code can compute it
+		// once per ray instead of once per box. On a hit, `t_enter` is where the ray enters the box.
+		for (int a = 0; a < 3; a++)
+		{
+			const interval& ax = axis(a);
+			auto t0 = (ax.min - origin[a]) * inv_dir[a];
+			auto t1 = (ax.max - origin[a]) * inv_dir[a];
+			if (inv_dir[a] < 0)
+				std::swap(t0, t1);
+
+			if (t0 > ray_t.min) ray_t.min = t0;
+			if (t1 < ray_t.max) ray_t.max = t1;
+
+			if (ray_t.max <= ray_t.min)
+				return false;
+		}
+		t_enter = ray_t.min;
+		return true;
+	}
+};
+
+#endif // !AABB_H
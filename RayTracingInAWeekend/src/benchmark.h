@@ -0,0 +1,261 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include "common.h"
+
+#include "camera.h"
+#include "cpu_features.h"
+#include "hittable_list.h"
+#include "scenes.h"
+#include "vec3_simd.h"
+
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(_WIN32)
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+
+// Throughput benchmark: builds the acceleration structure for each standard scene and renders
+// it headless with fixed seeds at 1, 2, 4, ... up to N threads, and writes one JSON document
+// with the results, so runs can be compared between commits and machines. Progress goes to
+// std::clog, the JSON to the given stream.
+
+inline std::uint64_t process_peak_rss_bytes()
+{
+    // Largest resident set of the process so far, over every scene measured before.
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.PeakWorkingSetSize;
+    return 0;
+#else
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#if defined(__APPLE__)
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+#else
+    return static_cast<std::uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+inline std::uint64_t current_rss_bytes()
+{
+    // Resident set right now, 0 where it can't be read.
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return counters.WorkingSetSize;
+    return 0;
+#elif defined(__linux__)
+    std::ifstream statm("/proc/self/statm");
+    std::uint64_t size = 0, resident = 0;
+    if (!(statm >> size >> resident))
+        return 0;
+    return resident * static_cast<std::uint64_t>(sysconf(_SC_PAGESIZE));
+#else
+    return 0;
+#endif
+}
+
+inline double benchmark_ratio(double value, double seconds)
+{
+    // Rates and speedups of runs too short to time are written as 0: JSON has no inf or nan.
+    return seconds > 0 ? value / seconds : 0;
+}
+
+class benchmark_options
+{
+public:
+    std::vector<std::string> scenes = scene_names();
+    std::string accel = "bvh4";
+    std::vector<bvh_build> builds = { bvh_build::sah, bvh_build::lbvh };    // For the BVH accelerators
+    int image_width = 400;
+    int samples_per_pixel = 16;
+    int max_depth = 50;
+    int max_threads = 0;        // Highest thread count measured, 0 uses std::thread::hardware_concurrency()
+    bool packet_tracing = false;
+    bool wavefront = false;
+};
+
+class benchmark_run
+{
+public:
+    std::string scene;
+    std::string build;          // BVH build strategy, "none" for other accelerators over scenes without meshes
+    int threads = 1;
+    double build_seconds = 0;   // Building the acceleration structure and the mesh BVHs with `threads` threads
+    double build_speedup = 1;   // Against the 1-thread build of the same scene
+    double seconds = 0;         // Rendering
+    std::uint64_t rays = 0;
+    std::uint64_t samples = 0;
+    double speedup = 1;         // Against the 1-thread run of the same scene
+    std::uint64_t scene_rss = 0;            // Resident set added since before the scene was built; memory
+                                            // an earlier scene freed and this one reused is not counted
+    std::uint64_t process_peak_rss = 0;     // Of the whole process up to the end of this run
+};
+
+inline std::vector<int> benchmark_thread_counts(int max_threads)
+{
+    // 1, 2, 4, ... and max_threads itself.
+    std::vector<int> counts;
+    for (int n = 1; n < max_threads; n *= 2)
+        counts.push_back(n);
+    counts.push_back(max_threads);
+    return counts;
+}
+
+inline void write_benchmark_json(std::ostream& out, const benchmark_options& options,
+                                 const std::vector<benchmark_run>& runs)
+{
+    // Scene names and option strings are plain identifiers, so nothing needs escaping.
+    out << "{\n";
+    out << "  \"precision\": \"" << precision_name() << "\",\n";
+    out << "  \"vec3\": \"" << vec3_backend_name() << "\",\n";
+    out << "  \"simd\": \"" << simd_level_name(cpu_simd_level()) << "\",\n";
+    out << "  \"accel\": \"" << options.accel << "\",\n";
+    out << "  \"mode\": \"" << (options.wavefront ? "wavefront" : options.packet_tracing ? "packets" : "single") << "\",\n";
+    out << "  \"width\": " << options.image_width << ",\n";
+    out << "  \"spp\": " << options.samples_per_pixel << ",\n";
+    out << "  \"max_depth\": " << options.max_depth << ",\n";
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"runs\": [\n";
+    for (std::size_t k = 0; k < runs.size(); ++k)
+    {
+        const benchmark_run& run = runs[k];
+        out << "    { \"scene\": \"" << run.scene << "\""
+            << ", \"build\": \"" << run.build << "\""
+            << ", \"threads\": " << run.threads
+            << ", \"build_seconds\": " << run.build_seconds
+            << ", \"build_speedup\": " << run.build_speedup
+            << ", \"wall_seconds\": " << run.seconds
+            << ", \"rays\": " << run.rays
+            << ", \"mrays_per_second\": " << benchmark_ratio(run.rays / 1e6, run.seconds)
+            << ", \"samples_per_second\": " << benchmark_ratio(static_cast<double>(run.samples), run.seconds)
+            << ", \"speedup\": " << run.speedup
+            << ", \"scene_rss_bytes\": " << run.scene_rss
+            << ", \"process_peak_rss_bytes\": " << run.process_peak_rss
+            << " }" << (k + 1 < runs.size() ? "," : "") << '\n';
+    }
+    out << "  ]\n";
+    out << "}\n";
+}
+
+inline bool run_benchmarks(const benchmark_options& options, std::ostream& out)
+{
+    int max_threads = options.max_threads > 0 ? options.max_threads : static_cast<int>(std::thread::hardware_concurrency());
+    if (max_threads < 1)
+        max_threads = 1;
+
+    std::vector<benchmark_run> runs;
+    for (const std::string& name : options.scenes)
+    {
+        // The process peak keeps the largest scene so far; growth over this is the scene's own.
+        std::uint64_t rss_before = current_rss_bytes();
+        hittable_list scene_objects;
+        camera cam;
+        if (!build_scene(name, scene_objects, cam))
+        {
+            std::cerr << "Unknown scene: " << name << '\n';
+            return false;
+        }
+        std::clog << name << ": " << scene_objects.objects.size() << " objects\n";
+
+        cam.aspect_ratio = 16.0 / 9.0;
+        cam.image_width = options.image_width;
+        cam.samples_per_pixel = options.samples_per_pixel;
+        cam.max_depth = options.max_depth;
+        cam.packet_tracing = options.packet_tracing;
+        cam.wavefront = options.wavefront;
+        cam.headless = true;
+        cam.quiet = true;
+
+        // BVH build strategies trade build time for trace time; each gets its own series. Mesh
+        // BVHs are built with the strategy too, so scenes with meshes get series under any accelerator.
+        std::vector<bvh_build> builds = options.builds;
+        bool bvh_accel = uses_bvh_build(options.accel, scene_objects);
+        if (!bvh_accel || builds.empty())
+            builds.assign(1, bvh_build::sah);
+
+        std::size_t first_run = runs.size();
+        for (bvh_build build : builds)
+        {
+            double single_thread_seconds = 0;
+            double single_thread_build_seconds = 0;
+            for (int threads : benchmark_thread_counts(max_threads))
+            {
+                // The structure is rebuilt at every thread count, so build scaling is measured too.
+                hittable_list world = scene_objects;
+                auto build_start = std::chrono::steady_clock::now();
+                if (!build_acceleration(options.accel, world, false, threads, build))
+                {
+                    std::cerr << "Unknown accelerator: " << options.accel << '\n';
+                    return false;
+                }
+                std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - build_start;
+
+                cam.num_threads = threads;
+                if (!cam.render(world))
+                    return false;
+
+                benchmark_run run;
+                run.scene = name;
+                run.build = bvh_accel ? bvh_build_name(build) : "none";
+                run.threads = threads;
+                run.build_seconds = build_time.count();
+                run.seconds = cam.render_seconds();
+                run.rays = cam.ray_count();
+                run.samples = cam.sample_count();
+                if (threads == 1)
+                {
+                    single_thread_seconds = run.seconds;
+                    single_thread_build_seconds = run.build_seconds;
+                }
+                run.speedup = benchmark_ratio(single_thread_seconds, run.seconds);
+                run.build_speedup = benchmark_ratio(single_thread_build_seconds, run.build_seconds);
+                std::uint64_t rss = current_rss_bytes();
+                run.scene_rss = rss > rss_before ? rss - rss_before : 0;
+                run.process_peak_rss = process_peak_rss_bytes();
+                runs.push_back(run);
+
+                std::clog << "  " << threads << " threads: " << options.accel << " (" << run.build << ") built in "
+                          << run.build_seconds << "s, rendered in " << run.seconds << "s, "
+                          << benchmark_ratio(run.rays / 1e6, run.seconds) << " Mrays/s\n";
+            }
+        }
+
+        // Compare the strategies at the highest thread count: what the faster build costs in rays.
+        std::size_t per_build = (runs.size() - first_run) / builds.size();
+        for (std::size_t b = 1; b < builds.size(); ++b)
+        {
+            const benchmark_run& base = runs[first_run + per_build - 1];
+            const benchmark_run& other = runs[first_run + (b + 1) * per_build - 1];
+            std::clog << "  " << other.build << " against " << base.build << ": "
+                      << benchmark_ratio(other.build_seconds, base.build_seconds) << "x the build time, "
+                      << benchmark_ratio(other.seconds, base.seconds) << "x the render time\n";
+        }
+    }
+
+    write_benchmark_json(out, options, runs);
+    return true;
+}
+
+#endif // !BENCHMARK_H
@@ -0,0 +1,700 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include "common.h"
+
+#include "aabb.h"
+#include "dispatch.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "parallel.h"
+#include "radix_sort.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bounding volume hierarchy over the objects of a hittable_list, built top-down with a binned
+// surface area heuristic. Nodes live in one flat array in depth-first order, and the objects
+// are reordered so every leaf refers to a contiguous range of them.
+//
+// Large builds run on several threads: near the root, where one node covers most of the
+// primitives, bounds and bins are computed in chunks in parallel; further down, the two halves
+// of a split are built as separate tasks, each with its share of the threads. Chunk results are
+// merged with exact min/max and sums, so the tree is the same for every thread count.
+//
+// The LBVH strategy trades tree quality for build speed, for scenes rebuilt every frame: it
+// sorts the primitives by the Morton code of their centroids with a parallel radix sort, then
+// emits the hierarchy in one top-down pass, splitting each range where the highest differing
+// code bit changes and computing boxes on the way back up. The result has the same layout, so
+// traversal and the wide BVHs work on either.
+//
+// When objects move, refit() recomputes the boxes in place instead of rebuilding. The splits
+// stay as they were, so the tree gets looser as objects drift; update() refits and rebuilds
+// when the SAH cost has grown past a limit since the last build.
+enum class bvh_build
+{
+	sah,
+	lbvh
+};
+
+inline const char* bvh_build_name(bvh_build build)
+{
+	return build == bvh_build::lbvh ? "lbvh" : "sah";
+}
+
+inline bool parse_bvh_build(const std::string& name, bvh_build& build)
+{
+	if (name == "sah")
+		build = bvh_build::sah;
+	else if (name == "lbvh")
+		build = bvh_build::lbvh;
+	else
+		return false;
+	return true;
+}
+
+class bvh : public hittable
+{
+public:
+	static const int bin_count = 16;       // SAH candidate split planes per axis are bin_count - 1
+	static const int max_leaf_size = 4;    // Larger ranges are always split
+	static const int max_depth = 64;       // Bounds the traversal stack
+	static const int single_ray_lanes = 2;     // Packet subtrees with this few rays are traced per ray
+	static const int parallel_grain = 8192;    // Fewest primitives per chunk of a parallel loop
+	static const int parallel_subtree_min = 4096;  // Smaller subtrees are built on the calling thread
+	static const int lbvh_leaf_size = 2;   // LBVH ranges this small become leaves
+
+	// build_threads 0 uses std::thread::hardware_concurrency().
+	bvh(const hittable_list& list, int build_threads = 0, bvh_build strategy = bvh_build::sah)
+		: bvh(list.objects, build_threads, strategy)
+	{
+
+	}
+
+	bvh(const std::vector<shared_ptr<hittable>>& src_objects, int build_threads = 0, bvh_build strategy = bvh_build::sah)
+		: hittable(hittable_kind::aggregate)
+	{
+		int threads = build_threads > 0 ? build_threads : static_cast<int>(std::thread::hardware_concurrency());
+		threads = std::max(threads, 1);
+		int count = static_cast<int>(src_objects.size());
+		build_thread_count = threads;
+		build_strategy = strategy;
+
+		std::vector<primitive_ref> refs(src_objects.size());
+		parallel_chunks(count, threads, parallel_grain, [&](int start, int end, int) {
+			for (int i = start; i < end; i++)
+			{
+				aabb box = src_objects[i]->bounding_box();
+				refs[i] = { box, box.centroid(), i };
+			}
+			});
+
+		nodes.reserve(refs.empty() ? 1 : 2 * refs.size() - 1);
+		nodes.push_back(node());
+		if (!refs.empty() && strategy == bvh_build::lbvh)
+			build_lbvh(refs, threads);
+		else if (!refs.empty())
+			build(refs, nodes, 0, 0, count, 0, threads);
+
+		objects.resize(refs.size());
+		parallel_chunks(count, threads, parallel_grain, [&](int start, int end, int) {
+			for (int i = start; i < end; i++)
+				objects[i] = src_objects[refs[i].index];
+			});
+
+		built_cost = sah_cost();
+	}
+
+	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+	{
+		if (objects.empty())
+			return false;
+
+		point3 origin = r.origin();
+		vec3 dir = r.direction();
+		vec3 inv_dir(1 / dir[0], 1 / dir[1], 1 / dir[2]);
+
+		double t_enter;
+		if (!nodes[0].bbox.hit(origin, inv_dir, ray_t, t_enter))
+			return false;
+
+		return traverse(0, r, inv_dir, ray_t, rec);
+	}
+
+	int hit_packet(ray_packet& packet, double t_min, int active, hit_record* recs) const override
+	{
+		// Rays pointing in different directions share few nodes, so such packets are traced
+		// one ray at a time.
+		if (objects.empty() || !packet.coherent(active))
+			return hittable::hit_packet(packet, t_min, active, recs);
+
+		class packet_entry
+		{
+		public:
+			int node;
+			int active;
+		};
+
+		packet_entry stack[max_depth];
+		int stack_size = 0;
+		int hits = 0;
+
+		double t_near;
+		int current_active = packet.hit_box(nodes[0].bbox, t_min, active, t_near);
+		int current = 0;
+
+		while (true)
+		{
+			const node& n = nodes[current];
+			RT_COUNT(thread_counters().node_visits += current_active != 0);
+
+			if (current_active != 0 && ray_packet::lane_count(current_active) <= single_ray_lanes)
+			{
+				// Too few rays are left on this subtree to share its nodes; finish them one at a time.
+				for (int k = 0; k < packet.size; k++)
+				{
+					if ((current_active & (1 << k))
+						&& traverse(current, packet.get(k), packet.inv_dir(k), interval(real(t_min), real(packet.t_max[k])), recs[k]))
+					{
+						packet.t_max[k] = recs[k].t;
+						hits |= 1 << k;
+					}
+				}
+			}
+			else if (current_active != 0 && n.count > 0)
+			{
+				for (int i = n.first; i < n.first + n.count; i++)
+					hits |= hit_object_packet(*objects[i], packet, t_min, current_active, recs);
+			}
+			else if (current_active != 0)
+			{
+				int left = n.first;
+				int right = n.first + 1;
+				double t_left, t_right;
+				int left_active = packet.hit_box(nodes[left].bbox, t_min, current_active, t_left);
+				int right_active = packet.hit_box(nodes[right].bbox, t_min, current_active, t_right);
+
+				if (left_active && right_active)
+				{
+					if (t_right < t_left)
+					{
+						std::swap(left, right);
+						std::swap(left_active, right_active);
+					}
+					stack[stack_size++] = { right, right_active };
+					current = left;
+					current_active = left_active;
+					continue;
+				}
+				if (left_active || right_active)
+				{
+					current = left_active ? left : right;
+					current_active = left_active ? left_active : right_active;
+					continue;
+				}
+			}
+
+			if (stack_size == 0)
+				break;
+
+			// Rays may have found closer hits since the entry was pushed; drop those that no
+			// longer reach its box.
+			stack_size--;
+			current = stack[stack_size].node;
+			current_active = packet.hit_box(nodes[current].bbox, t_min, stack[stack_size].active, t_near);
+		}
+
+		return hits;
+	}
+
+	aabb bounding_box() const override { return nodes[0].bbox; }
+
+	void visit_children(const std::function<void(hittable&)>& visit) const override
+	{
+		for (const auto& object : objects)
+			visit(*object);
+	}
+
+	int node_count() const { return static_cast<int>(nodes.size()); }
+
+	double sah_cost() const
+	{
+		// Expected work for a ray that enters the root: every node is weighed by its area
+		// relative to the root's, a node visit and a primitive test costing one unit each.
+		double root_area = nodes[0].bbox.surface_area();
+		if (objects.empty() || root_area <= 0)
+			return 0;
+
+		double cost = 0;
+		for (const node& n : nodes)
+			cost += n.bbox.surface_area() * (n.count > 0 ? n.count : 1);
+		return cost / root_area;
+	}
+
+	// SAH cost now against right after the last build.
+	double cost_growth() const { return built_cost > 0 ? sah_cost() / built_cost : 1; }
+
+	void refit()
+	{
+		// Recomputes every box from the objects' current bounds. Children always come after
+		// their parent in the array, so one backward sweep finishes them before it.
+		if (objects.empty())
+			return;
+
+		for (int i = node_count() - 1; i >= 0; i--)
+		{
+			node& n = nodes[i];
+			if (n.count > 0)
+			{
+				aabb bounds;
+				for (int k = n.first; k < n.first + n.count; k++)
+					bounds = aabb(bounds, objects[k]->bounding_box());
+				n.bbox = bounds;
+			}
+			else
+			{
+				n.bbox = aabb(nodes[n.first].bbox, nodes[n.first + 1].bbox);
+			}
+		}
+	}
+
+	bool update(double max_cost_growth = 1.5)
+	{
+		// Refits after objects moved, and rebuilds the same way as before if that left the
+		// tree more than max_cost_growth times as expensive as when it was built. Returns
+		// whether it rebuilt.
+		refit();
+		if (cost_growth() <= max_cost_growth)
+			return false;
+
+		*this = bvh(objects, build_thread_count, build_strategy);
+		return true;
+	}
+
+private:
+	template <int N> friend class wide_bvh;
+	friend class triangle_mesh;
+
+	class node
+	{
+	public:
+		aabb bbox;
+		int first = 0;  // Leaf: index of the first object. Interior: index of the left child (right is first + 1), which is after this node.
+		int count = 0;  // Number of objects in a leaf, 0 for interior nodes.
+	};
+
+	class primitive_ref
+	{
+	public:
+		aabb bbox;
+		point3 centroid;
+		int index;
+	};
+
+	class bin
+	{
+	public:
+		aabb bbox;
+		int count = 0;
+	};
+
+	std::vector<node> nodes;
+	std::vector<shared_ptr<hittable>> objects;
+	int build_thread_count = 1;
+	bvh_build build_strategy = bvh_build::sah;
+	double built_cost = 0;     // sah_cost() right after building
+
+	bool traverse(int root, const ray& r, const vec3& inv_dir, interval ray_t, hit_record& rec) const
+	{
+		// Closest hit within the subtree at `root`, whose box the caller has already entered.
+		point3 origin = r.origin();
+
+		int stack[max_depth];
+		int stack_size = 0;
+		int current = root;
+
+		hit_record temp_rec;
+		bool hit_anything = false;
+		auto closest_so_far = ray_t.max;
+
+		while (true)
+		{
+			const node& n = nodes[current];
+			RT_COUNT(thread_counters().node_visits++);
+
+			if (n.count > 0)
+			{
+				for (int i = n.first; i < n.first + n.count; i++)
+				{
+					if (hit_object(*objects[i], r, interval(ray_t.min, closest_so_far), temp_rec))
+					{
+						hit_anything = true;
+						closest_so_far = temp_rec.t;
+						rec = temp_rec;
+					}
+				}
+			}
+			else
+			{
+				// Visit the nearer child first so closest_so_far shrinks early and prunes the other.
+				int left = n.first;
+				int right = n.first + 1;
+				double t_left, t_right;
+				bool hit_left = nodes[left].bbox.hit(origin, inv_dir, interval(ray_t.min, closest_so_far), t_left);
+				bool hit_right = nodes[right].bbox.hit(origin, inv_dir, interval(ray_t.min, closest_so_far), t_right);
+
+				if (hit_left && hit_right)
+				{
+					if (t_right < t_left)
+						std::swap(left, right);
+					stack[stack_size++] = right;
+					current = left;
+					continue;
+				}
+				if (hit_left)
+				{
+					current = left;
+					continue;
+				}
+				if (hit_right)
+				{
+					current = right;
+					continue;
+				}
+			}
+
+			if (stack_size == 0)
+				break;
+			current = stack[--stack_size];
+		}
+
+		return hit_anything;
+	}
+
+	void build(std::vector<primitive_ref>& refs, std::vector<node>& out, int node_index, int start, int end, int depth, int threads)
+	{
+		// Builds the subtree over refs[start, end) at out[node_index], appending its nodes to
+		// `out`, with up to `threads` threads.
+		int count = end - start;
+		int chunks = parallel_chunk_count(count, threads, parallel_grain);
+
+		aabb bounds;
+		aabb centroid_bounds;
+		std::vector<aabb> chunk_bounds(2 * static_cast<size_t>(chunks - 1));
+		parallel_chunks(count, threads, parallel_grain, [&](int s, int e, int chunk) {
+			aabb b, cb;
+			for (int i = start + s; i < start + e; i++)
+			{
+				b = aabb(b, refs[i].bbox);
+				cb = aabb(cb, aabb(refs[i].centroid, refs[i].centroid));
+			}
+			if (chunk == 0)
+			{
+				bounds = b;
+				centroid_bounds = cb;
+			}
+			else
+			{
+				chunk_bounds[2 * (chunk - 1)] = b;
+				chunk_bounds[2 * (chunk - 1) + 1] = cb;
+			}
+			});
+		for (int c = 1; c < chunks; c++)
+		{
+			bounds = aabb(bounds, chunk_bounds[2 * (c - 1)]);
+			centroid_bounds = aabb(centroid_bounds, chunk_bounds[2 * (c - 1) + 1]);
+		}
+
+		out[node_index].bbox = bounds;
+
+		if (count == 1 || depth >= max_depth - 1)
+		{
+			make_leaf(out, node_index, start, count);
+			return;
+		}
+
+		int axis = centroid_bounds.longest_axis();
+		const interval& extent = centroid_bounds.axis(axis);
+		int mid = start;
+
+		if (extent.size() <= 0)
+		{
+			// All centroids coincide, so no plane can separate them.
+			if (count <= max_leaf_size)
+			{
+				make_leaf(out, node_index, start, count);
+				return;
+			}
+		}
+		else
+		{
+			bin bins[bin_count];
+			std::vector<bin> chunk_bins(static_cast<size_t>(chunks - 1) * bin_count);
+			auto scale = bin_count / extent.size();
+			parallel_chunks(count, threads, parallel_grain, [&](int s, int e, int chunk) {
+				bin* local = chunk == 0 ? bins : &chunk_bins[static_cast<size_t>(chunk - 1) * bin_count];
+				for (int i = start + s; i < start + e; i++)
+				{
+					bin& b = local[bin_of(refs[i].centroid[axis], extent.min, scale)];
+					b.bbox = aabb(b.bbox, refs[i].bbox);
+					b.count++;
+				}
+				});
+			for (size_t k = 0; k < chunk_bins.size(); k++)
+			{
+				bin& b = bins[k % bin_count];
+				b.bbox = aabb(b.bbox, chunk_bins[k].bbox);
+				b.count += chunk_bins[k].count;
+			}
+
+			// Sweep from the right to get the cost of every right-hand side, then from the left
+			// to evaluate each split plane.
+			double right_area[bin_count - 1];
+			int right_count[bin_count - 1];
+			aabb right_box;
+			int right_sum = 0;
+			for (int k = bin_count - 1; k > 0; k--)
+			{
+				right_box = aabb(right_box, bins[k].bbox);
+				right_sum += bins[k].count;
+				right_area[k - 1] = right_box.surface_area();
+				right_count[k - 1] = right_sum;
+			}
+
+			int best_split = -1;
+			double best_cost = infinity;
+			aabb left_box;
+			int left_sum = 0;
+			for (int k = 0; k < bin_count - 1; k++)
+			{
+				left_box = aabb(left_box, bins[k].bbox);
+				left_sum += bins[k].count;
+				if (left_sum == 0 || right_count[k] == 0)
+					continue;
+
+				double cost = left_sum * left_box.surface_area() + right_count[k] * right_area[k];
+				if (cost < best_cost)
+				{
+					best_cost = cost;
+					best_split = k;
+				}
+			}
+
+			// Traversing a node costs about one primitive test; keep the range as a leaf when
+			// splitting does not pay for that.
+			double leaf_cost = count * bounds.surface_area();
+			double split_cost = bounds.surface_area() + best_cost;
+			if (count <= max_leaf_size && leaf_cost <= split_cost)
+			{
+				make_leaf(out, node_index, start, count);
+				return;
+			}
+
+			if (best_split >= 0)
+			{
+				auto it = std::partition(refs.begin() + start, refs.begin() + end,
+					[=](const primitive_ref& ref) {
+						return bin_of(ref.centroid[axis], extent.min, scale) <= best_split;
+					});
+				mid = static_cast<int>(it - refs.begin());
+			}
+		}
+
+		if (mid == start || mid == end)
+		{
+			// No usable plane: fall back to an object median split.
+			mid = start + count / 2;
+			std::nth_element(refs.begin() + start, refs.begin() + mid, refs.begin() + end,
+				[=](const primitive_ref& a, const primitive_ref& b) {
+					return a.centroid[axis] < b.centroid[axis];
+				});
+		}
+
+		int left = static_cast<int>(out.size());
+		out.push_back(node());
+		out.push_back(node());
+		out[node_index].first = left;
+		out[node_index].count = 0;
+
+		build_children(out, left, start, mid, end, threads,
+			[&](std::vector<node>& child_out, int child, int s, int e, int child_threads) {
+				build(refs, child_out, child, s, e, depth + 1, child_threads);
+			});
+	}
+
+	void build_lbvh(std::vector<primitive_ref>& refs, int threads)
+	{
+		int count = static_cast<int>(refs.size());
+		int chunks = parallel_chunk_count(count, threads, parallel_grain);
+
+		std::vector<aabb> chunk_bounds(chunks);
+		parallel_chunks(count, threads, parallel_grain, [&](int s, int e, int chunk) {
+			aabb cb;
+			for (int i = s; i < e; i++)
+				cb = aabb(cb, aabb(refs[i].centroid, refs[i].centroid));
+			chunk_bounds[chunk] = cb;
+			});
+		aabb centroid_bounds;
+		for (const aabb& cb : chunk_bounds)
+			centroid_bounds = aabb(centroid_bounds, cb);
+
+		std::vector<std::uint64_t> codes(refs.size());
+		std::vector<int> order(refs.size());
+		parallel_chunks(count, threads, parallel_grain, [&](int s, int e, int) {
+			for (int i = s; i < e; i++)
+			{
+				codes[i] = morton_code(refs[i].centroid, centroid_bounds);
+				order[i] = i;
+			}
+			});
+
+		radix_sort(codes, order, threads);
+
+		std::vector<primitive_ref> sorted(refs.size());
+		parallel_chunks(count, threads, parallel_grain, [&](int s, int e, int) {
+			for (int i = s; i < e; i++)
+				sorted[i] = refs[order[i]];
+			});
+		refs.swap(sorted);
+
+		emit_lbvh(refs, codes, nodes, 0, 0, count, 0, threads);
+	}
+
+	void emit_lbvh(const std::vector<primitive_ref>& refs, const std::vector<std::uint64_t>& codes,
+		std::vector<node>& out, int node_index, int start, int end, int depth, int threads)
+	{
+		// Like build(), but the split comes from the sorted codes and boxes are made bottom-up.
+		int count = end - start;
+		if (count <= lbvh_leaf_size || depth >= max_depth - 1)
+		{
+			aabb bounds;
+			for (int i = start; i < end; i++)
+				bounds = aabb(bounds, refs[i].bbox);
+			out[node_index].bbox = bounds;
+			make_leaf(out, node_index, start, count);
+			return;
+		}
+
+		int mid = morton_split(codes, start, end);
+
+		int left = static_cast<int>(out.size());
+		out.push_back(node());
+		out.push_back(node());
+		out[node_index].first = left;
+		out[node_index].count = 0;
+
+		build_children(out, left, start, mid, end, threads,
+			[&](std::vector<node>& child_out, int child, int s, int e, int child_threads) {
+				emit_lbvh(refs, codes, child_out, child, s, e, depth + 1, child_threads);
+			});
+
+		out[node_index].bbox = aabb(out[left].bbox, out[left + 1].bbox);
+	}
+
+	template <typename Node, typename BuildFunc>
+	static void build_children(std::vector<Node>& out, int left, int start, int mid, int end, int threads, BuildFunc&& build_child)
+	{
+		// Builds the subtrees over [start, mid) and [mid, end) at out[left] and out[left + 1] by
+		// calling build_child(out, node_index, start, end, threads). Node is any node type with
+		// first and count, interior when count is 0, so triangle_mesh builds with it too.
+		int count = end - start;
+		if (threads > 1 && count >= parallel_subtree_min)
+		{
+			// The left half goes to a new thread with its own node array, spliced in afterwards;
+			// the threads are shared in proportion to the primitives on each side.
+			int left_threads = static_cast<int>(std::lround(static_cast<double>(threads) * (mid - start) / count));
+			left_threads = std::min(std::max(left_threads, 1), threads - 1);
+
+			std::vector<Node> left_nodes;
+			left_nodes.reserve(2 * static_cast<size_t>(mid - start) - 1);
+			left_nodes.push_back(Node());
+			std::thread worker([&]() {
+				build_child(left_nodes, 0, start, mid, left_threads);
+				});
+			build_child(out, left + 1, mid, end, threads - left_threads);
+			worker.join();
+			splice(out, left, left_nodes);
+			return;
+		}
+
+		build_child(out, left, start, mid, 1);
+		build_child(out, left + 1, mid, end, 1);
+	}
+
+	static void make_leaf(std::vector<node>& out, int node_index, int start, int count)
+	{
+		out[node_index].first = start;
+		out[node_index].count = count;
+	}
+
+	template <typename Node>
+	static void splice(std::vector<Node>& out, int at, const std::vector<Node>& subtree)
+	{
+		// Puts the subtree's root at out[at] and appends the rest, shifting child indices.
+		// Leaves point into the shared object array, so they stay as they are.
+		int base = static_cast<int>(out.size()) - 1;
+		auto relocate = [base](Node n) {
+			if (n.count == 0)
+				n.first += base;
+			return n;
+		};
+		out[at] = relocate(subtree[0]);
+		for (size_t k = 1; k < subtree.size(); k++)
+			out.push_back(relocate(subtree[k]));
+	}
+
+	static std::uint64_t morton_code(const point3& p, const aabb& bounds)
+	{
+		// 21 bits per axis, interleaved x, y, z from the top bit down.
+		std::uint64_t code = 0;
+		for (int a = 0; a < 3; a++)
+		{
+			const interval& extent = bounds.axis(a);
+			double u = extent.size() > 0 ? (p[a] - extent.min) / extent.size() : 0;
+			auto q = static_cast<std::uint64_t>(std::min(std::max(u, 0.0), 1.0) * 2097151.0);
+			code |= spread_bits(q) << (2 - a);
+		}
+		return code;
+	}
+
+	static std::uint64_t spread_bits(std::uint64_t x)
+	{
+		// Moves bit k of a 21-bit value to bit 3k.
+		x &= 0x1fffff;
+		x = (x | x << 32) & 0x1f00000000ffffull;
+		x = (x | x << 16) & 0x1f0000ff0000ffull;
+		x = (x | x << 8) & 0x100f00f00f00f00full;
+		x = (x | x << 4) & 0x10c30c30c30c30c3ull;
+		x = (x | x << 2) & 0x1249249249249249ull;
+		return x;
+	}
+
+	static int morton_split(const std::vector<std::uint64_t>& codes, int start, int end)
+	{
+		// The codes in [start, end) are sorted and share every bit above the highest one in
+		// which the first and last differ, so the range splits where that bit turns on.
+		std::uint64_t differ = codes[start] ^ codes[end - 1];
+		if (differ == 0)
+			return start + (end - start) / 2;
+
+		for (int shift = 1; shift < 64; shift *= 2)
+			differ |= differ >> shift;
+		std::uint64_t top_bit = differ ^ (differ >> 1);
+
+		auto it = std::partition_point(codes.begin() + start, codes.begin() + end,
+			[top_bit](std::uint64_t code) { return (code & top_bit) == 0; });
+		return static_cast<int>(it - codes.begin());
+	}
+
+	static int bin_of(double c, double min, double scale)
+	{
+		int b = static_cast<int>((c - min) * scale);
+		return b < 0 ? 0 : (b >= bin_count ? bin_count - 1 : b);
+	}
+};
+
+#endif // !BVH_H
@@ -0,0 +1,502 @@
+#ifndef BVH_WIDE_H
+#define BVH_WIDE_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "cpu_features.h"
+#include "dispatch.h"
+#include "hittable.h"
+
+#include <type_traits>
+#include <vector>
+
+// N-ary BVH (N = 4 or 8) made by collapsing a binary bvh. Each node stores the boxes of all its
+// children as separate coordinate arrays, so one sequence of vector instructions tests every
+// child: AVX2 for N = 4 and AVX-512 for N = 8 (4 and 8 doubles), with a scalar loop on CPUs
+// without them. Children that are hit are visited nearest first. Refitting and rebuilding on
+// SAH cost growth work as in bvh.
+template <int N>
+class wide_bvh : public hittable
+{
+public:
+    static_assert(N == 4 || N == 8, "wide_bvh supports 4 or 8 children per node");
+
+    // build_threads is passed on to the binary build; collapsing it is serial and much cheaper.
+    wide_bvh(const hittable_list& list, int build_threads = 0, bvh_build strategy = bvh_build::sah)
+        : wide_bvh(bvh(list, build_threads, strategy))
+    {
+
+    }
+
+    wide_bvh(const bvh& binary)
+        : hittable(hittable_kind::aggregate), objects(binary.objects), bbox(binary.bounding_box()),
+          build_thread_count(binary.build_thread_count), build_strategy(binary.build_strategy)
+    {
+        if (objects.empty())
+            return;
+
+        nodes.reserve(binary.nodes.size() / (N - 1) + 1);
+        if (binary.nodes[0].count > 0)
+        {
+            // A single leaf: wrap it so traversal always starts at an interior node.
+            nodes.push_back(empty_node());
+            set_child(nodes[0], 0, binary.nodes[0], 0);
+        }
+        else
+        {
+            collapse(binary, 0);
+        }
+
+        use_simd = (N == 4 && static_cast<int>(cpu_simd_level()) >= static_cast<int>(simd_level::avx2))
+                || (N == 8 && cpu_simd_level() == simd_level::avx512);
+        built_cost = sah_cost();
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        return traverse({ 0, 0, ray_t.min }, r, ray_t, rec);
+    }
+
+    int hit_packet(ray_packet& packet, double t_min, int active, hit_record* recs) const override
+    {
+        // Each node's children are tested for every active ray with the SIMD kernel, and a
+        // child is visited by the rays that entered it. Diverging packets are traced one ray at a
+        // time, as are the last few rays left on a subtree.
+        if (nodes.empty() || !packet.coherent(active))
+            return hittable::hit_packet(packet, t_min, active, recs);
+
+        class packet_entry
+        {
+        public:
+            entry e;
+            int active;
+        };
+
+        packet_entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = { { 0, 0, t_min }, active };
+        int hits = 0;
+
+        while (stack_size > 0)
+        {
+            packet_entry pe = stack[--stack_size];
+            const entry& e = pe.e;
+
+            int live = 0;
+            for (int k = 0; k < packet.size; k++)
+            {
+                if ((pe.active & (1 << k)) && e.t_near < packet.t_max[k])
+                    live |= 1 << k;
+            }
+            if (live == 0)
+                continue;
+            RT_COUNT(thread_counters().node_visits++);
+
+            if (ray_packet::lane_count(live) <= bvh::single_ray_lanes)
+            {
+                for (int k = 0; k < packet.size; k++)
+                {
+                    if ((live & (1 << k)) && traverse(e, packet.get(k), interval(real(t_min), real(packet.t_max[k])), recs[k]))
+                    {
+                        packet.t_max[k] = recs[k].t;
+                        hits |= 1 << k;
+                    }
+                }
+                continue;
+            }
+
+            if (e.count > 0)
+            {
+                for (int i = e.index; i < e.index + e.count; i++)
+                    hits |= hit_object_packet(*objects[i], packet, t_min, live, recs);
+                continue;
+            }
+
+            const node& n = nodes[e.index];
+            int child_active[N];
+            double child_near[N];
+            for (int c = 0; c < N; c++)
+            {
+                child_active[c] = 0;
+                if (n.count[c] < 0)
+                    continue;
+                const double box_min[3] = { n.min_x[c], n.min_y[c], n.min_z[c] };
+                const double box_max[3] = { n.max_x[c], n.max_y[c], n.max_z[c] };
+                child_active[c] = packet.hit_box(box_min, box_max, t_min, live, child_near[c]);
+            }
+
+            // Push the farthest child first, as in traverse().
+            int order[N];
+            int count = 0;
+            for (int c = 0; c < N; c++)
+            {
+                if (!child_active[c])
+                    continue;
+                int pos = count++;
+                while (pos > 0 && child_near[order[pos - 1]] < child_near[c])
+                {
+                    order[pos] = order[pos - 1];
+                    pos--;
+                }
+                order[pos] = c;
+            }
+
+            for (int h = 0; h < count; h++)
+            {
+                int c = order[h];
+                stack[stack_size++] = { { n.child[c], n.count[c], child_near[c] }, child_active[c] };
+            }
+        }
+
+        return hits;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void visit_children(const std::function<void(hittable&)>& visit) const override
+    {
+        for (const auto& object : objects)
+            visit(*object);
+    }
+
+    int node_count() const { return static_cast<int>(nodes.size()); }
+
+    double sah_cost() const
+    {
+        // As bvh::sah_cost(), over the children's boxes: one unit per interior child entered,
+        // one per object of a leaf child, plus the root.
+        double root_area = bbox.surface_area();
+        if (nodes.empty() || root_area <= 0)
+            return 0;
+
+        double cost = root_area;
+        for (const node& n : nodes)
+        {
+            for (int k = 0; k < N; k++)
+            {
+                if (n.count[k] >= 0)
+                    cost += slot_box(n, k).surface_area() * (n.count[k] > 0 ? n.count[k] : 1);
+            }
+        }
+        return cost / root_area;
+    }
+
+    double cost_growth() const { return built_cost > 0 ? sah_cost() / built_cost : 1; }
+
+    void refit()
+    {
+        // Children come after their parent here too, so a backward sweep sees them first.
+        for (int i = node_count() - 1; i >= 0; i--)
+        {
+            node& n = nodes[i];
+            for (int k = 0; k < N; k++)
+            {
+                if (n.count[k] < 0)
+                    continue;
+
+                aabb box;
+                if (n.count[k] > 0)
+                {
+                    for (int o = n.child[k]; o < n.child[k] + n.count[k]; o++)
+                        box = aabb(box, objects[o]->bounding_box());
+                }
+                else
+                {
+                    box = node_box(nodes[n.child[k]]);
+                }
+                n.min_x[k] = box.x.min; n.max_x[k] = box.x.max;
+                n.min_y[k] = box.y.min; n.max_y[k] = box.y.max;
+                n.min_z[k] = box.z.min; n.max_z[k] = box.z.max;
+            }
+        }
+        if (!nodes.empty())
+            bbox = node_box(nodes[0]);
+    }
+
+    bool update(double max_cost_growth = 1.5)
+    {
+        // See bvh::update(); a rebuild builds the binary tree again and collapses it.
+        refit();
+        if (cost_growth() <= max_cost_growth)
+            return false;
+
+        *this = wide_bvh(bvh(objects, build_thread_count, build_strategy));
+        return true;
+    }
+
+private:
+    class node
+    {
+    public:
+        double min_x[N], min_y[N], min_z[N];
+        double max_x[N], max_y[N], max_z[N];
+        int child[N];   // Interior child: node index. Leaf child: index of its first object.
+        int count[N];   // Leaf child: number of objects. 0 for interior children, -1 for empty slots.
+    };
+
+    class ray_consts
+    {
+    public:
+        double origin[3];
+        double inv_dir[3];
+    };
+
+    class entry
+    {
+    public:
+        int index;
+        int count;
+        double t_near;
+    };
+
+    static const int stack_capacity = 64 * (N - 1) + 1;
+
+    std::vector<node> nodes;
+    std::vector<shared_ptr<hittable>> objects;
+    aabb bbox;
+    bool use_simd = false;
+    int build_thread_count = 1;
+    bvh_build build_strategy = bvh_build::sah;
+    double built_cost = 0;     // sah_cost() right after building
+
+    bool traverse(const entry& start, const ray& r, interval ray_t, hit_record& rec) const
+    {
+        // Closest hit below `start`, which is a node or a leaf range.
+        ray_consts rc;
+        point3 origin = r.origin();
+        vec3 dir = r.direction();
+        for (int a = 0; a < 3; a++)
+        {
+            rc.origin[a] = origin[a];
+            rc.inv_dir[a] = 1 / dir[a];
+        }
+
+        entry stack[stack_capacity];
+        int stack_size = 0;
+        stack[stack_size++] = start;
+
+        hit_record temp_rec;
+        bool hit_anything = false;
+        auto closest_so_far = ray_t.max;
+
+        while (stack_size > 0)
+        {
+            entry e = stack[--stack_size];
+            if (e.t_near >= closest_so_far)
+                continue;
+            RT_COUNT(thread_counters().node_visits++);
+
+            if (e.count > 0)
+            {
+                for (int i = e.index; i < e.index + e.count; i++)
+                {
+                    if (hit_object(*objects[i], r, interval(ray_t.min, closest_so_far), temp_rec))
+                    {
+                        hit_anything = true;
+                        closest_so_far = temp_rec.t;
+                        rec = temp_rec;
+                    }
+                }
+                continue;
+            }
+
+            const node& n = nodes[e.index];
+            double t_near[N];
+            int mask = intersect_children(n, rc, ray_t.min, closest_so_far, t_near);
+            if (mask == 0)
+                continue;
+
+            // Sort the hit children by entry distance, then push the farthest first so the
+            // nearest is popped next.
+            int order[N];
+            int hits = 0;
+            for (int k = 0; k < N; k++)
+            {
+                if (!(mask & (1 << k)))
+                    continue;
+                int pos = hits++;
+                while (pos > 0 && t_near[order[pos - 1]] < t_near[k])
+                {
+                    order[pos] = order[pos - 1];
+                    pos--;
+                }
+                order[pos] = k;
+            }
+
+            for (int h = 0; h < hits; h++)
+            {
+                int k = order[h];
+                stack[stack_size++] = { n.child[k], n.count[k], t_near[k] };
+            }
+        }
+
+        return hit_anything;
+    }
+
+    static aabb slot_box(const node& n, int k)
+    {
+        return aabb(interval(real(n.min_x[k]), real(n.max_x[k])),
+                    interval(real(n.min_y[k]), real(n.max_y[k])),
+                    interval(real(n.min_z[k]), real(n.max_z[k])));
+    }
+
+    static aabb node_box(const node& n)
+    {
+        aabb box;
+        for (int k = 0; k < N; k++)
+        {
+            if (n.count[k] >= 0)
+                box = aabb(box, slot_box(n, k));
+        }
+        return box;
+    }
+
+    static node empty_node()
+    {
+        // Empty slots get a degenerate box at +infinity. An inverted box would not do: the slab
+        // test orders each axis' entry and exit with min/max, which turns it into an infinite one.
+        node n;
+        for (int k = 0; k < N; k++)
+        {
+            n.min_x[k] = n.min_y[k] = n.min_z[k] = +infinity;
+            n.max_x[k] = n.max_y[k] = n.max_z[k] = +infinity;
+            n.child[k] = 0;
+            n.count[k] = -1;
+        }
+        return n;
+    }
+
+    void set_child(node& n, int k, const bvh::node& source, int index) const
+    {
+        n.min_x[k] = source.bbox.x.min; n.max_x[k] = source.bbox.x.max;
+        n.min_y[k] = source.bbox.y.min; n.max_y[k] = source.bbox.y.max;
+        n.min_z[k] = source.bbox.z.min; n.max_z[k] = source.bbox.z.max;
+        n.child[k] = source.count > 0 ? source.first : index;
+        n.count[k] = source.count;
+    }
+
+    int collapse(const bvh& binary, int binary_index)
+    {
+        // Replaces the binary node with up to N descendants by repeatedly opening the interior
+        // candidate with the largest surface area, then collapses each interior candidate.
+        int candidates[N];
+        int candidate_count = 2;
+        candidates[0] = binary.nodes[binary_index].first;
+        candidates[1] = binary.nodes[binary_index].first + 1;
+
+        while (candidate_count < N)
+        {
+            int widest = -1;
+            double widest_area = -1;
+            for (int k = 0; k < candidate_count; k++)
+            {
+                const bvh::node& c = binary.nodes[candidates[k]];
+                if (c.count == 0 && c.bbox.surface_area() > widest_area)
+                {
+                    widest = k;
+                    widest_area = c.bbox.surface_area();
+                }
+            }
+            if (widest < 0)
+                break;
+
+            int opened = candidates[widest];
+            candidates[widest] = binary.nodes[opened].first;
+            candidates[candidate_count++] = binary.nodes[opened].first + 1;
+        }
+
+        int index = static_cast<int>(nodes.size());
+        nodes.push_back(empty_node());
+
+        for (int k = 0; k < candidate_count; k++)
+        {
+            const bvh::node& c = binary.nodes[candidates[k]];
+            int child_index = c.count > 0 ? 0 : collapse(binary, candidates[k]);
+            set_child(nodes[index], k, c, child_index);
+        }
+
+        return index;
+    }
+
+    int intersect_children(const node& n, const ray_consts& rc, double t_min, double t_max, double* t_near) const
+    {
+        // Returns a bit mask of the children whose box the ray enters within (t_min, t_max),
+        // and each child's entry distance.
+#if RT_X86
+        if (use_simd)
+            return intersect_simd(std::integral_constant<int, N>(), n, rc, t_min, t_max, t_near);
+#endif
+        return intersect_scalar(n, rc, t_min, t_max, t_near);
+    }
+
+    static int intersect_scalar(const node& n, const ray_consts& rc, double t_min, double t_max, double* t_near)
+    {
+        int mask = 0;
+        for (int k = 0; k < N; k++)
+        {
+            double x0 = (n.min_x[k] - rc.origin[0]) * rc.inv_dir[0], x1 = (n.max_x[k] - rc.origin[0]) * rc.inv_dir[0];
+            double y0 = (n.min_y[k] - rc.origin[1]) * rc.inv_dir[1], y1 = (n.max_y[k] - rc.origin[1]) * rc.inv_dir[1];
+            double z0 = (n.min_z[k] - rc.origin[2]) * rc.inv_dir[2], z1 = (n.max_z[k] - rc.origin[2]) * rc.inv_dir[2];
+
+            double lo = fmax(fmax(fmin(x0, x1), fmin(y0, y1)), fmax(fmin(z0, z1), t_min));
+            double hi = fmin(fmin(fmax(x0, x1), fmax(y0, y1)), fmin(fmax(z0, z1), t_max));
+
+            t_near[k] = lo;
+            if (lo < hi)
+                mask |= 1 << k;
+        }
+        return mask;
+    }
+
+#if RT_X86
+    RT_TARGET("avx2")
+    static int intersect_simd(std::integral_constant<int, 4>, const node& n, const ray_consts& rc, double t_min, double t_max, double* t_near)
+    {
+        __m256d ox = _mm256_set1_pd(rc.origin[0]), oy = _mm256_set1_pd(rc.origin[1]), oz = _mm256_set1_pd(rc.origin[2]);
+        __m256d ix = _mm256_set1_pd(rc.inv_dir[0]), iy = _mm256_set1_pd(rc.inv_dir[1]), iz = _mm256_set1_pd(rc.inv_dir[2]);
+
+        __m256d x0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(n.min_x), ox), ix);
+        __m256d x1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(n.max_x), ox), ix);
+        __m256d y0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(n.min_y), oy), iy);
+        __m256d y1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(n.max_y), oy), iy);
+        __m256d z0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(n.min_z), oz), iz);
+        __m256d z1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_loadu_pd(n.max_z), oz), iz);
+
+        __m256d lo = _mm256_max_pd(_mm256_max_pd(_mm256_min_pd(x0, x1), _mm256_min_pd(y0, y1)),
+                                   _mm256_max_pd(_mm256_min_pd(z0, z1), _mm256_set1_pd(t_min)));
+        __m256d hi = _mm256_min_pd(_mm256_min_pd(_mm256_max_pd(x0, x1), _mm256_max_pd(y0, y1)),
+                                   _mm256_min_pd(_mm256_max_pd(z0, z1), _mm256_set1_pd(t_max)));
+
+        _mm256_storeu_pd(t_near, lo);
+        return _mm256_movemask_pd(_mm256_cmp_pd(lo, hi, _CMP_LT_OQ));
+    }
+
+    RT_TARGET("avx512f")
+    static int intersect_simd(std::integral_constant<int, 8>, const node& n, const ray_consts& rc, double t_min, double t_max, double* t_near)
+    {
+        __m512d ox = _mm512_set1_pd(rc.origin[0]), oy = _mm512_set1_pd(rc.origin[1]), oz = _mm512_set1_pd(rc.origin[2]);
+        __m512d ix = _mm512_set1_pd(rc.inv_dir[0]), iy = _mm512_set1_pd(rc.inv_dir[1]), iz = _mm512_set1_pd(rc.inv_dir[2]);
+
+        __m512d x0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_loadu_pd(n.min_x), ox), ix);
+        __m512d x1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_loadu_pd(n.max_x), ox), ix);
+        __m512d y0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_loadu_pd(n.min_y), oy), iy);
+        __m512d y1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_loadu_pd(n.max_y), oy), iy);
+        __m512d z0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_loadu_pd(n.min_z), oz), iz);
+        __m512d z1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_loadu_pd(n.max_z), oz), iz);
+
+        __m512d lo = _mm512_max_pd(_mm512_max_pd(_mm512_min_pd(x0, x1), _mm512_min_pd(y0, y1)),
+                                   _mm512_max_pd(_mm512_min_pd(z0, z1), _mm512_set1_pd(t_min)));
+        __m512d hi = _mm512_min_pd(_mm512_min_pd(_mm512_max_pd(x0, x1), _mm512_max_pd(y0, y1)),
+                                   _mm512_min_pd(_mm512_max_pd(z0, z1), _mm512_set1_pd(t_max)));
+
+        _mm512_storeu_pd(t_near, lo);
+        return static_cast<int>(_mm512_cmp_pd_mask(lo, hi, _CMP_LT_OQ));
+    }
+#endif
+};
+
+#endif // !BVH_WIDE_H
@@ -4,13 +4,26 @@
 #include "common.h"
 
 #include "color.h"
+#include "dispatch.h"
+#include "framebuffer.h"
+#include "heatmap.h"
 #include "hittable.h"
+#include "image_compare.h"
+#include "image_writer.h"
 #include "material.h"
-
+#include "render_stats.h"
+#include "tile_scheduler.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <mutex>
+#include <string>
 #include <SFML/Graphics.hpp>
 
-// UNCOMMENT FOR ALTERNATIVE RENDERING LOOP
 #include <thread>
 #include <vector>
 
@@ -32,56 +45,237 @@ public:
 
     bool fastRender = false;
 
-    void render(const hittable& world)
+    int tile_size = 32;             // Tile edge length in pixels for the threaded renderer
+    int num_threads = 0;            // Worker threads, 0 uses std::thread::hardware_concurrency()
+    bool print_thread_stats = true; // Report per-thread busy/idle time after a threaded render
+    bool quiet = false;             // Headless renders print nothing, for callers that report results themselves
+
+    std::uint64_t seed = 0;         // Base seed for the per-pixel, per-sample random streams
+
+    bool russian_roulette = true;   // Randomly end low-throughput paths instead of always tracing to max_depth
+    int rr_min_depth = 3;           // Bounces every path survives before Russian roulette applies
+
+    bool headless = false;          // Render with the threaded path and write output_file without opening a window
+    std::string output_file;        // .ppm, .pfm (linear float), or anything sf::Image can save, e.g. .png
+    std::string compare_file;       // Reference .pfm a headless render is compared with, e.g. from a double precision build
+    std::string heatmap_file;       // Per-pixel cost of a headless render as a false-color image (.pfm: raw values)
+    bool heatmap_tests = false;     // Cost is BVH node visits + primitive tests (needs RT_STATS 1) instead of time
+
+    bool adaptive_sampling = false; // Stop sampling a pixel once its estimated error is below adaptive_threshold
+    int min_samples_per_pixel = 16; // Samples every pixel gets before it may stop; samples_per_pixel is the maximum
+    double adaptive_threshold = 0.01;   // Target 95% error of a pixel's displayed (gamma-corrected) value, 1/256 = one 8-bit step
+    int adaptive_batch = 8;         // Samples taken between convergence checks
+
+    bool progressive = false;       // Render 1 spp passes into the buffer while the window shows the running average
+    int preview_fps = 30;           // Window refresh rate while a progressive render is running
+
+    bool packet_tracing = false;    // Trace camera rays in 4x2 pixel packets and later bounces as ray streams
+    bool wavefront = false;         // Trace batches of paths in stages, shading hits grouped by material
+    int wavefront_batch = 4096;     // Paths in flight per tile in wavefront mode; a batch's paths and hits fit in L2
+
+    // Returns false if writing the image or heatmap, or reading the --compare reference, failed.
+    bool render(const hittable& world)
     {
-        if (fastRender == false)
+        bool ok = true;
+        check_sampling_options();
+        if (headless)
+        {
+            initialize();
+
+            if (heatmap_tests && !RT_STATS)
+            {
+                std::cerr << "Counting intersection tests needs a build with RT_STATS 1; the heatmap shows time\n";
+                heatmap_tests = false;
+            }
+            if (!heatmap_file.empty() && !heatmap_tests && (packet_tracing || wavefront))
+            {
+                std::cerr << "Batched tracing interleaves a tile's pixels, so the time heatmap shows tile averages; "
+                             "--heatmap-tests (RT_STATS 1) gives per-pixel cost\n";
+            }
+
+            if (!quiet)
+                std::cout << image_width << "px by " << image_height << "px\n";
+
+            auto start = std::chrono::steady_clock::now();
+            {
+                trace_scope span("render", "render");
+                render_tiles(world);
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            last_render_seconds = elapsed.count();
+
+            last_sample_count = 0;
+            for (int j = 0; j < image_height; ++j)
+                for (int i = 0; i < image_width; ++i)
+                    last_sample_count += film.sample_count(i, j);
+
+            if (!quiet)
+            {
+                std::clog << "Rendered in " << last_render_seconds << "s with " << precision_name() << " math, "
+                          << last_sample_count / last_render_seconds / 1e6 << "M camera rays/s, "
+                          << last_ray_count / last_render_seconds / 1e6 << "M rays/s\n";
+            }
+
+            ok &= save_output();
+            ok &= save_heatmap();
+            ok &= compare_output();
+        }
+        else if (progressive)
         {
             initialize();
 
-            // Declare sf::Image before usage
-            sf::Image backgroundImage;
-            backgroundImage.create(image_width, image_height, sf::Color::Black);
+            std::cout << image_width << "px by " << image_height << "px\n";
+            std::cout << "Rendering progressively, press Escape to stop refining" << std::endl;
+
+            sf::RenderWindow window(sf::VideoMode(image_width, image_height), "Ray Tracer");
+            window.setFramerateLimit(preview_fps);
+
+            sf::Texture texture;
+            texture.create(image_width, image_height);
+            sf::Sprite sprite(texture);
+            std::vector<std::uint8_t> display_pixels;
+
+            std::atomic<bool> stop(false);
+            std::atomic<bool> finished(false);
+            std::atomic<int> passes_done(0);
+            last_counters.clear();
+
+            // The workers' sums are only read between passes: the pass thread tonemaps each
+            // finished pass into `snapshot`, and the window copies the latest one out.
+            std::mutex snapshot_lock;
+            std::vector<std::uint8_t> snapshot;
+            bool snapshot_fresh = false;
+
+            auto start = std::chrono::steady_clock::now();
+
+            // Passes run on their own thread so the window keeps refreshing on this one.
+            std::thread renderer([this, &world, &stop, &finished, &passes_done, &snapshot_lock, &snapshot, &snapshot_fresh]() {
+                render_trace().name_thread("progressive passes");
+                for (int pass = 0; pass < samples_per_pixel && !stop; ++pass)
+                {
+                    {
+                        trace_scope span("render", "pass", "\"sample\": " + std::to_string(pass));
+                        render_pass(world, pass, stop);
+                    }
+                    if (!stop)
+                        passes_done++;
+
+                    std::lock_guard<std::mutex> lock(snapshot_lock);
+                    film.tonemap_rgba8(snapshot);
+                    snapshot_fresh = true;
+                }
+                finished = true;
+                });
+
+            int shown_passes = -1;
+            while (window.isOpen())
+            {
+                sf::Event event;
+                while (window.pollEvent(event))
+                {
+                    if (event.type == sf::Event::Closed)
+                    {
+                        stop = true;
+                        window.close();
+                    }
+                    else if (event.type == sf::Event::KeyPressed && event.key.code == sf::Keyboard::Escape)
+                    {
+                        stop = true;
+                    }
+                }
+
+                if (renderer.joinable() && finished)
+                {
+                    renderer.join();
+                    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+                    std::clog << "\r" << passes_done << " passes in " << elapsed.count() << "s          \n";
+                    report_counters();
+                    ok &= save_output();
+                }
+
+                if (!window.isOpen())
+                    break;
+
+                trace_scope span("display", "display update");
+
+                {
+                    std::lock_guard<std::mutex> lock(snapshot_lock);
+                    if (snapshot_fresh)
+                    {
+                        display_pixels.swap(snapshot);
+                        snapshot_fresh = false;
+                        texture.update(display_pixels.data());
+                    }
+                }
+
+                if (passes_done != shown_passes)
+                {
+                    shown_passes = passes_done;
+                    window.setTitle("Ray Tracer - " + std::to_string(shown_passes) + "/"
+                        + std::to_string(samples_per_pixel) + " spp");
+                    std::clog << "\rPasses complete: " << shown_passes << ' ' << std::flush;
+                }
+
+                window.clear();
+                window.draw(sprite);
+                window.display();
+            }
+
+            stop = true;
+            if (renderer.joinable())
+            {
+                renderer.join();
+                report_counters();
+                ok &= save_output();
+            }
+        }
+        else if (fastRender == false)
+        {
+            initialize();
 
             std::cout << image_width << "px by " << image_height << "px\n";
 
             sf::RenderWindow window(sf::VideoMode(image_width, image_height), "Ray Tracer");
 
-            // Create a vertex array to hold the pixels
-            sf::VertexArray pixels(sf::Points, image_width * image_height);
+            // The window shows a texture that is refreshed from the accumulation buffer
+            sf::Texture texture;
+            texture.create(image_width, image_height);
+            sf::Sprite sprite(texture);
+            std::vector<std::uint8_t> display_pixels;
 
             std::cout << "\rRendering in real-time..." << std::endl;
 
             // Add these lines for the update frequency
             const int update_frequency = 10;  // Update window every 10 scanlines
             int update_counter = 0;
+            last_counters.assign(1, render_counters());
 
             for (int j = 0; j < image_height; ++j)
             {
                 std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
 
-                for (int i = 0; i < image_width; ++i)
                 {
-                    color pixel_color(0, 0, 0);
-                    for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                        ray r = get_ray(i, j);
-                        pixel_color += ray_color(r, max_depth, world);
+                    trace_scope span("render", "scanline", "\"y\": " + std::to_string(j));
+                    thread_counters() = render_counters();
+                    for (int i = 0; i < image_width; ++i)
+                    {
+                        color pixel_color(0, 0, 0);
+                        int samples = sample_pixel(i, j, world, pixel_color);
+                        film.add_samples(i, j, pixel_color, samples);
                     }
-
-                    sf::Color sfml_color = to_sfml_color(pixel_color, samples_per_pixel);
-                    backgroundImage.setPixel(i, j, sfml_color);
-
-                    // Set the color of the corresponding pixel in the vertex array
-                    pixels[i + j * image_width].position = sf::Vector2f(i, j);
-                    pixels[i + j * image_width].color = sfml_color;
+                    last_counters[0].add(thread_counters());
                 }
 
                 // Increment the update counter
                 update_counter++;
 
                 if (update_counter >= update_frequency) {
-                    // Clear the window and draw the vertex array
+                    trace_scope span("display", "display update");
+                    film.tonemap_rgba8(display_pixels);
+                    texture.update(display_pixels.data());
+
                     window.clear();
-                    window.draw(pixels);
+                    window.draw(sprite);
                     window.display();
 
                     // Reset the counter
@@ -90,11 +284,19 @@ public:
             }
 
             // After the loop, ensure to update the window with any remaining pixels
-            window.clear();
-            window.draw(pixels);
-            window.display();
+            {
+                trace_scope span("display", "display update");
+                film.tonemap_rgba8(display_pixels);
+                texture.update(display_pixels.data());
+                window.clear();
+                window.draw(sprite);
+                window.display();
+            }
 
             std::clog << "\rDone.                 \n";
+            report_counters();
+
+            ok &= save_output();
 
             // Main loop
             while (window.isOpen())
@@ -112,51 +314,26 @@ public:
         {
             initialize();
 
-            // Declare sf::Image before usage
-            sf::Image backgroundImage;
-            backgroundImage.create(image_width, image_height, sf::Color::Black);
-
             std::cout << image_width << "px by " << image_height << "px\n";
 
             // create the window
             std::cout << "\rWindow will open when calculation have completed " << std::endl;
 
-            std::vector<std::thread> threads;
-            const int num_threads = std::thread::hardware_concurrency();
-
-            for (int t = 0; t < num_threads; ++t)
             {
-                threads.emplace_back([this, &world, t, num_threads, &backgroundImage]() {
-                    for (int j = t; j < image_height; j += num_threads)
-                    {
-                        std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-                        for (int i = 0; i < image_width; ++i)
-                        {
-                            color pixel_color(0, 0, 0);
-                            for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                                ray r = get_ray(i, j);
-                                pixel_color += ray_color(r, max_depth, world);
-                            }
-
-                            sf::Color sfml_color = to_sfml_color(pixel_color, samples_per_pixel);
-                            backgroundImage.setPixel(i, j, sfml_color);
-                        }
-                    }
-                    });
+                trace_scope span("render", "render");
+                render_tiles(world);
             }
+            ok &= save_output();
 
-            for (auto& thread : threads)
-            {
-                thread.join();
-            }
-
-            std::clog << "\rDone.                 \n";
+            std::vector<std::uint8_t> display_pixels;
+            film.tonemap_rgba8(display_pixels);
 
             sf::RenderWindow window(sf::VideoMode(800, 450), "Ray Tracer");
 
             // Create a texture and sprite to display the image
             sf::Texture backgroundTexture;
-            backgroundTexture.loadFromImage(backgroundImage);
+            backgroundTexture.create(image_width, image_height);
+            backgroundTexture.update(display_pixels.data());
             sf::Sprite backgroundSprite(backgroundTexture);
 
             // Main loop
@@ -180,10 +357,21 @@ public:
                 window.display();
             }
         }
-        
+
+        return ok;
     }
 
+    // Linear HDR result of the last render
+    const framebuffer& image() const { return film; }
+
+    // Measurements of the last headless render
+    double render_seconds() const { return last_render_seconds; }
+    std::uint64_t sample_count() const { return last_sample_count; }
+    std::uint64_t ray_count() const { return last_ray_count; }     // Rays intersected with the scene, all bounces
 
+    // Work counters of the last render, per render thread, in every mode. Only the ray counts
+    // are filled in unless the renderer is built with RT_STATS 1.
+    const std::vector<render_counters>& counters() const { return last_counters; }
 
 private:
     int     image_height;   // Rendered image height
@@ -194,24 +382,625 @@ private:
     vec3    u, v, w;
     vec3    defocus_disk_u;
     vec3    defocus_disk_v;
+    framebuffer film;       // Accumulated samples, tonemapped only for display and 8-bit output
+
+    double last_render_seconds = 0;
+    std::uint64_t last_sample_count = 0;
+    std::uint64_t last_ray_count = 0;
+    std::vector<render_counters> last_counters;
+    cost_map costs;         // Per-pixel cost of the last headless render, when heatmap_file is set
+
+    class trace_tile
+    {
+    public:
+        // Timeline span for one tile, on a thread labelled with its worker index.
+        trace_tile(const tile& t, int thread) : t(t), thread(thread), start(0)
+        {
+            if (!render_trace().enabled())
+                return;
+            render_trace().name_thread("render worker " + std::to_string(thread));
+            start = render_trace().now();
+        }
+
+        ~trace_tile()
+        {
+            if (!render_trace().enabled())
+                return;
+            render_trace().record("render", "tile", start, render_trace().now(),
+                "\"x\": " + std::to_string(t.x0) + ", \"y\": " + std::to_string(t.y0)
+                + ", \"w\": " + std::to_string(t.x1 - t.x0) + ", \"h\": " + std::to_string(t.y1 - t.y0)
+                + ", \"worker\": " + std::to_string(thread));
+        }
+
+    private:
+        const tile& t;
+        int thread;
+        double start;
+    };
+
+    void render_tiles(const hittable& world)
+    {
+        // Renders the whole image on the tile scheduler into the accumulation buffer.
+        tile_scheduler scheduler(image_width, image_height, tile_size, thread_count());
+
+        std::atomic<int> tiles_remaining(scheduler.tile_count());
+        last_counters.assign(scheduler.threads(), render_counters());
+
+        bool record_costs = !heatmap_file.empty();
+        if (record_costs)
+            costs.resize(image_width, image_height);
+
+        bool use_batches = packet_tracing || wavefront;
+
+        scheduler.run([this, &world, &tiles_remaining, use_batches, record_costs](const tile& t, int thread) {
+            trace_tile span(t, thread);
+
+            // Each thread counts into its thread-local counters, collected after every tile.
+            thread_counters() = render_counters();
+
+            if (use_batches)
+            {
+                // Pixels are traced interleaved, so time can only be measured per tile and each
+                // pixel gets an equal share. Tests are charged to the pixels of each packet's paths.
+                double tile_start = record_costs ? cost_clock() : 0;
+                std::vector<double> pixel_tests;
+                if (record_costs && heatmap_tests)
+                    pixel_tests.assign((t.x1 - t.x0) * (t.y1 - t.y0), 0.0);
+                std::vector<double>* tests_out = pixel_tests.empty() ? nullptr : &pixel_tests;
+
+                // Sums are per pixel and in sample order, as in sample_pixel.
+                std::vector<color> sums((t.x1 - t.x0) * (t.y1 - t.y0), color(0, 0, 0));
+                if (wavefront)
+                {
+                    trace_wavefront(t, 0, samples_per_pixel, world, sums, tests_out);
+                }
+                else
+                {
+                    std::vector<path_state> paths;
+                    for (int sample = 0; sample < samples_per_pixel; ++sample)
+                        trace_stream(t, sample, world, paths, sums, tests_out);
+                }
+
+                for (int j = t.y0; j < t.y1; ++j)
+                    for (int i = t.x0; i < t.x1; ++i)
+                        film.add_samples(i, j, sums[(i - t.x0) + (j - t.y0) * (t.x1 - t.x0)], samples_per_pixel);
+
+                if (record_costs)
+                {
+                    double share = (cost_clock() - tile_start) / ((t.x1 - t.x0) * (t.y1 - t.y0));
+                    for (int j = t.y0; j < t.y1; ++j)
+                        for (int i = t.x0; i < t.x1; ++i)
+                            costs.set(i, j, tests_out ? pixel_tests[(i - t.x0) + (j - t.y0) * (t.x1 - t.x0)] : share);
+                }
+            }
+            else
+            {
+                for (int j = t.y0; j < t.y1; ++j)
+                {
+                    for (int i = t.x0; i < t.x1; ++i)
+                    {
+                        double pixel_start = record_costs ? cost_clock() : 0;
+                        color pixel_color(0, 0, 0);
+                        int samples = sample_pixel(i, j, world, pixel_color);
+                        film.add_samples(i, j, pixel_color, samples);
+                        if (record_costs)
+                            costs.set(i, j, cost_clock() - pixel_start);
+                    }
+                }
+            }
+
+            last_counters[thread].add(thread_counters());
+
+            int remaining = --tiles_remaining;
+            if (!quiet)
+                std::clog << "\rTiles remaining: " << remaining << ' ' << std::flush;
+            });
+
+        if (!quiet)
+        {
+            std::clog << "\rDone.                 \n";
+            if (print_thread_stats)
+                scheduler.print_stats(std::clog);
+        }
+        report_counters();
+
+        if (!quiet && adaptive_sampling)
+            print_sampling_stats();
+    }
+
+    int sample_pixel(int i, int j, const hittable& world, color& pixel_color) const
+    {
+        // Adds the samples for pixel i,j to pixel_color and returns how many were taken.
+        if (!adaptive_sampling)
+        {
+            for (int sample = 0; sample < samples_per_pixel; ++sample) {
+                seed_pixel_sample(seed, i, j, sample);
+                ray r = get_ray(i, j);
+                pixel_color += ray_color(r, max_depth, world);
+            }
+            return samples_per_pixel;
+        }
+
+        // Welford's running mean and variance of the sample luminance.
+        int min_samples = std::max(2, std::min(min_samples_per_pixel, samples_per_pixel));
+        double mean = 0;
+        double m2 = 0;
+        int n = 0;
+
+        while (n < samples_per_pixel)
+        {
+            seed_pixel_sample(seed, i, j, n);
+            ray r = get_ray(i, j);
+            color sample_color = ray_color(r, max_depth, world);
+            pixel_color += sample_color;
+
+            n++;
+            double l = luminance(sample_color);
+            double delta = l - mean;
+            mean += delta / n;
+            m2 += delta * (l - mean);
+
+            if (n >= min_samples && (n - min_samples) % adaptive_batch == 0)
+            {
+                // 95% confidence half-width of the mean, converted to display space: the
+                // gamma-2 transform scales a small error e at luminance L by 1 / (2 sqrt(L)).
+                double error = 1.96 * sqrt(m2 / (n - 1) / n);
+                double display_error = error / (2 * sqrt(std::max(mean, 1e-4)));
+                if (display_error <= adaptive_threshold)
+                    break;
+            }
+        }
+
+        return n;
+    }
+
+    void print_sampling_stats() const
+    {
+        long long taken = 0;
+        int at_max = 0;
+        for (int j = 0; j < image_height; ++j)
+        {
+            for (int i = 0; i < image_width; ++i)
+            {
+                int n = film.sample_count(i, j);
+                taken += n;
+                if (n >= samples_per_pixel)
+                    at_max++;
+            }
+        }
+
+        long long budget = static_cast<long long>(samples_per_pixel) * image_width * image_height;
+        double pixels = static_cast<double>(image_width) * image_height;
+        std::clog << "Adaptive sampling: " << taken << " of " << budget << " samples ("
+                  << 100.0 * (budget - taken) / budget << "% saved), "
+                  << taken / pixels << " spp average, "
+                  << 100.0 * at_max / pixels << "% of pixels hit the " << samples_per_pixel << " spp limit\n";
+    }
+
+    void report_counters()
+    {
+        // Totals the per-thread counters of the render just finished, and prints them in
+        // RT_STATS builds.
+        last_ray_count = 0;
+        for (const render_counters& c : last_counters)
+            last_ray_count += c.rays();
+
+#if RT_STATS
+        if (!quiet)
+            print_render_counters(std::clog, last_counters);
+#endif
+    }
+
+    void render_pass(const hittable& world, int sample, const std::atomic<bool>& stop)
+    {
+        // Adds sample number `sample` to every pixel. Tiles not yet started when `stop` is set
+        // are skipped; the buffer's per-pixel counts keep the average correct either way. Work
+        // counters add up in last_counters over the passes.
+        tile_scheduler scheduler(image_width, image_height, tile_size, thread_count());
+        if (last_counters.size() < static_cast<size_t>(scheduler.threads()))
+            last_counters.resize(scheduler.threads());
+
+        scheduler.run([this, &world, sample, &stop](const tile& t, int thread) {
+            if (stop)
+                return;
+
+            trace_tile span(t, thread);
+            thread_counters() = render_counters();
+
+            if (packet_tracing || wavefront)
+            {
+                std::vector<color> sums((t.x1 - t.x0) * (t.y1 - t.y0), color(0, 0, 0));
+                std::vector<path_state> paths;
+                if (wavefront)
+                    trace_wavefront(t, sample, 1, world, sums);
+                else
+                    trace_stream(t, sample, world, paths, sums);
+
+                for (int j = t.y0; j < t.y1; ++j)
+                    for (int i = t.x0; i < t.x1; ++i)
+                        film.add_sample(i, j, sums[(i - t.x0) + (j - t.y0) * (t.x1 - t.x0)]);
+            }
+            else
+            {
+                for (int j = t.y0; j < t.y1; ++j)
+                {
+                    for (int i = t.x0; i < t.x1; ++i)
+                    {
+                        seed_pixel_sample(seed, i, j, sample);
+                        ray r = get_ray(i, j);
+                        film.add_sample(i, j, ray_color(r, max_depth, world));
+                    }
+                }
+            }
+
+            last_counters[thread].add(thread_counters());
+            });
+    }
+
+    class path_state
+    {
+    public:
+        ray r;
+        color throughput;
+        int slot;       // Where the result goes: the tile's sums (stream) or results (wavefront)
+        pcg32 rng;      // The path's own random stream, swapped into thread_rng() while it scatters
+    };
+
+    void trace_stream(const tile& t, int sample, const hittable& world,
+                      std::vector<path_state>& paths, std::vector<color>& sums,
+                      std::vector<double>* pixel_tests = nullptr) const
+    {
+        // Traces sample `sample` of every pixel in the tile breadth first: each bounce intersects
+        // all live paths in packets, then shades them. Camera rays are generated in 4x2 pixel
+        // blocks so each packet is coherent; after shading, the survivors are compacted so later
+        // packets stay full. Every path uses the random stream ray_color() would, so the image
+        // matches the single-ray renderer exactly. With `pixel_tests`, each packet's intersection
+        // tests are shared out to its paths' pixels.
+        paths.clear();
+        generate_paths(t, sample, paths, nullptr);
+
+        ray_packet packet;
+        hit_record recs[ray_packet::max_size];
+
+        for (int bounce = 0; bounce < max_depth && !paths.empty(); ++bounce)
+        {
+            thread_counters().count_rays(bounce, paths.size());
+            std::size_t alive = 0;
+            for (std::size_t base = 0; base < paths.size(); base += ray_packet::max_size)
+            {
+                packet.clear();
+                std::size_t end = std::min(paths.size(), base + ray_packet::max_size);
+                for (std::size_t p = base; p < end; ++p)
+                    packet.add(paths[p].r);
+
+                double tests_before = pixel_tests ? cost_clock() : 0;
+                int hits = world.hit_packet(packet, 0, packet.full_mask(), recs);
+                if (pixel_tests)
+                {
+                    double share = (cost_clock() - tests_before) / packet.size;
+                    for (int k = 0; k < packet.size; ++k)
+                        (*pixel_tests)[paths[base + k].slot] += share;
+                }
+
+                for (int k = 0; k < packet.size; ++k)
+                {
+                    path_state p = paths[base + k];
+
+                    if (!(hits & (1 << k)))
+                    {
+                        RT_COUNT(thread_counters().escaped++);
+                        sums[p.slot] += p.throughput * background(p.r);
+                        continue;
+                    }
+
+                    thread_rng() = p.rng;
+                    bool survives = scatter(p.r, p.throughput, recs[k], bounce);
+                    p.rng = thread_rng();
+
+                    // Compacting in place is safe: `alive` never passes the path being read.
+                    if (survives)
+                        paths[alive++] = p;
+                }
+            }
+            paths.resize(alive);
+        }
+        RT_COUNT(thread_counters().depth_limit += paths.size());
+    }
+
+    void generate_paths(const tile& t, int sample, std::vector<path_state>& paths, std::vector<int>* slot_pixels) const
+    {
+        // Appends the camera paths for sample `sample` of every pixel in the tile, in 4x2 pixel
+        // blocks so consecutive rays form coherent packets. Each path's slot is its pixel's
+        // index in the tile, or with `slot_pixels` the next free slot, whose pixel is recorded.
+        const int block_w = 4;
+        const int block_h = ray_packet::max_size / block_w;
+        int tile_w = t.x1 - t.x0;
+
+        for (int by = t.y0; by < t.y1; by += block_h)
+        {
+            for (int bx = t.x0; bx < t.x1; bx += block_w)
+            {
+                for (int j = by; j < std::min(by + block_h, t.y1); ++j)
+                {
+                    for (int i = bx; i < std::min(bx + block_w, t.x1); ++i)
+                    {
+                        int pixel = (i - t.x0) + (j - t.y0) * tile_w;
+
+                        seed_pixel_sample(seed, i, j, sample);
+                        path_state p;
+                        p.r = get_ray(i, j);
+                        p.throughput = color(1, 1, 1);
+                        p.slot = pixel;
+                        p.rng = thread_rng();
+
+                        if (slot_pixels)
+                        {
+                            p.slot = static_cast<int>(slot_pixels->size());
+                            slot_pixels->push_back(pixel);
+                        }
+                        paths.push_back(p);
+                    }
+                }
+            }
+        }
+    }
+
+    void trace_wavefront(const tile& t, int first_sample, int sample_count, const hittable& world,
+                         std::vector<color>& sums, std::vector<double>* pixel_tests = nullptr) const
+    {
+        // Wavefront path tracing: up to wavefront_batch paths advance one bounce at a time through
+        // separate stages instead of one path running to completion.
+        //   generate   camera paths for as many samples of the tile as fit in a batch
+        //   intersect  every live path, in packets
+        //   sort       hits by material kind (counting sort of path indices)
+        //   shade      each kind as one contiguous run with direct, inlinable scatter() calls
+        //   compact    survivors into the next bounce's batch
+        // Results are kept per path and summed per pixel in sample order at the end, so the
+        // image matches the single-ray renderer exactly. `pixel_tests` is as in trace_stream().
+        const int kind_count = static_cast<int>(material_kind::other) + 1;
+
+        int tile_pixels = (t.x1 - t.x0) * (t.y1 - t.y0);
+        int samples_per_batch = std::max(1, wavefront_batch / tile_pixels);
+
+        std::vector<path_state> paths;
+        std::vector<path_state> next;
+        std::vector<hit_record> recs;
+        std::vector<unsigned char> kinds;
+        std::vector<int> order;
+        std::vector<int> slot_pixels;
+        std::vector<color> results;
+        ray_packet packet;
+
+        for (int s0 = first_sample; s0 < first_sample + sample_count; s0 += samples_per_batch)
+        {
+            int s1 = std::min(s0 + samples_per_batch, first_sample + sample_count);
+
+            paths.clear();
+            slot_pixels.clear();
+            for (int sample = s0; sample < s1; ++sample)
+                generate_paths(t, sample, paths, &slot_pixels);
+            results.assign(paths.size(), color(0, 0, 0));
+
+            for (int bounce = 0; bounce < max_depth && !paths.empty(); ++bounce)
+            {
+                // Intersect. Misses are finished here with the background.
+                thread_counters().count_rays(bounce, paths.size());
+                recs.resize(paths.size());
+                kinds.resize(paths.size());
+                int counts[kind_count] = {};
+
+                for (std::size_t base = 0; base < paths.size(); base += ray_packet::max_size)
+                {
+                    packet.clear();
+                    std::size_t end = std::min(paths.size(), base + ray_packet::max_size);
+                    for (std::size_t p = base; p < end; ++p)
+                        packet.add(paths[p].r);
+
+                    double tests_before = pixel_tests ? cost_clock() : 0;
+                    int hits = world.hit_packet(packet, 0, packet.full_mask(), &recs[base]);
+                    if (pixel_tests)
+                    {
+                        double share = (cost_clock() - tests_before) / packet.size;
+                        for (int k = 0; k < packet.size; ++k)
+                            (*pixel_tests)[slot_pixels[paths[base + k].slot]] += share;
+                    }
+
+                    for (int k = 0; k < packet.size; ++k)
+                    {
+                        const path_state& p = paths[base + k];
+                        if (hits & (1 << k))
+                        {
+                            int kind = static_cast<int>(recs[base + k].mat->kind());
+                            kinds[base + k] = static_cast<unsigned char>(kind);
+                            counts[kind]++;
+                        }
+                        else
+                        {
+                            RT_COUNT(thread_counters().escaped++);
+                            results[p.slot] = p.throughput * background(p.r);
+                            kinds[base + k] = kind_count;
+                        }
+                    }
+                }
+
+                // Sort.
+                int offsets[kind_count + 1] = {};
+                for (int k = 0; k < kind_count; ++k)
+                    offsets[k + 1] = offsets[k] + counts[k];
+                order.resize(offsets[kind_count]);
+                int fill[kind_count];
+                std::copy(offsets, offsets + kind_count, fill);
+                for (std::size_t p = 0; p < paths.size(); ++p)
+                {
+                    if (kinds[p] < kind_count)
+                        order[fill[kinds[p]]++] = static_cast<int>(p);
+                }
+
+                // Shade and compact.
+                RT_COUNT(for (int k = 0; k < kind_count; ++k) thread_counters().scatters[k] += counts[k]);
+                next.clear();
+                const int* first = order.data();
+                shade_batch(first + offsets[0], first + offsets[1], paths, recs, next, bounce,
+                    [](const material* m, const ray& r, const hit_record& rec, color& attenuation, ray& scattered) {
+                        return static_cast<const lambertian*>(m)->lambertian::scatter(r, rec, attenuation, scattered);
+                    });
+                shade_batch(first + offsets[1], first + offsets[2], paths, recs, next, bounce,
+                    [](const material* m, const ray& r, const hit_record& rec, color& attenuation, ray& scattered) {
+                        return static_cast<const metal*>(m)->metal::scatter(r, rec, attenuation, scattered);
+                    });
+                shade_batch(first + offsets[2], first + offsets[3], paths, recs, next, bounce,
+                    [](const material* m, const ray& r, const hit_record& rec, color& attenuation, ray& scattered) {
+                        return static_cast<const dielectric*>(m)->dielectric::scatter(r, rec, attenuation, scattered);
+                    });
+                shade_batch(first + offsets[3], first + offsets[4], paths, recs, next, bounce,
+                    [](const material* m, const ray& r, const hit_record& rec, color& attenuation, ray& scattered) {
+                        return m->scatter(r, rec, attenuation, scattered);
+                    });
+
+                paths.swap(next);
+            }
+            RT_COUNT(thread_counters().depth_limit += paths.size());
+
+            for (std::size_t slot = 0; slot < results.size(); ++slot)
+                sums[slot_pixels[slot]] += results[slot];
+        }
+    }
+
+    template <typename ScatterFunc>
+    void shade_batch(const int* first, const int* last, const std::vector<path_state>& paths,
+                     const std::vector<hit_record>& recs, std::vector<path_state>& survivors,
+                     int bounce, ScatterFunc scatter_func) const
+    {
+        // Shades the hits of one material kind and appends the paths that continue.
+        for (const int* it = first; it != last; ++it)
+        {
+            path_state p = paths[*it];
+            const hit_record& rec = recs[*it];
+
+            thread_rng() = p.rng;
+            ray scattered;
+            color attenuation;
+            bool scattered_ok = scatter_func(rec.mat, p.r, rec, attenuation, scattered);
+            RT_COUNT(thread_counters().absorbed += !scattered_ok);
+            bool survives = scattered_ok && continue_path(p.r, p.throughput, scattered, attenuation, bounce);
+            p.rng = thread_rng();
+
+            if (survives)
+                survivors.push_back(p);
+        }
+    }
+
+    int thread_count() const
+    {
+        int n = num_threads > 0 ? num_threads : static_cast<int>(std::thread::hardware_concurrency());
+        return n > 0 ? n : 1;
+    }
+
+    bool save_output() const
+    {
+        if (output_file.empty())
+            return true;
+
+        trace_scope span("io", "write image");
+
+        if (!write_image(output_file, film))
+        {
+            std::cerr << "Failed to write " << output_file << '\n';
+            return false;
+        }
+        std::clog << "Wrote " << output_file << '\n';
+        return true;
+    }
+
+    double cost_clock() const
+    {
+        // Running total of the calling thread's work in the heatmap's unit; pixel and tile
+        // costs are differences of it.
+        if (heatmap_tests)
+        {
+            const render_counters& c = thread_counters();
+            return static_cast<double>(c.node_visits + c.primitive_tests);
+        }
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    bool save_heatmap() const
+    {
+        if (heatmap_file.empty())
+            return true;
+
+        trace_scope span("io", "write heatmap");
+
+        if (!costs.write(heatmap_file, heatmap_tests ? "tests" : "us", std::clog))
+        {
+            std::cerr << "Failed to write " << heatmap_file << '\n';
+            return false;
+        }
+        std::clog << "Wrote " << heatmap_file << '\n';
+        return true;
+    }
+
+    bool compare_output() const
+    {
+        if (compare_file.empty())
+            return true;
+
+        trace_scope span("io", "compare");
+
+        pfm_image reference;
+        image_difference diff;
+        if (!read_pfm(compare_file, reference))
+        {
+            std::cerr << "Failed to read " << compare_file << '\n';
+            return false;
+        }
+        if (!compare_images(film, reference, diff))
+        {
+            std::cerr << compare_file << " is " << reference.width << "x" << reference.height
+                      << ", the render is " << image_width << "x" << image_height << '\n';
+            return false;
+        }
+        std::clog << "Compared with " << compare_file << ": ";
+        diff.print(std::clog);
+        return true;
+    }
+
+    void check_sampling_options()
+    {
+        // Adaptive sampling decides per pixel and sample, which neither the batched tracers nor
+        // the one-sample progressive passes do; say which option gives way instead of dropping
+        // it silently.
+        adaptive_batch = std::max(1, adaptive_batch);
+        if (!adaptive_sampling)
+            return;
+
+        if (progressive && !headless)
+        {
+            std::cerr << "Progressive passes take one sample per pixel each; adaptive sampling is ignored\n";
+            adaptive_sampling = false;
+        }
+        else if (packet_tracing || wavefront)
+        {
+            std::cerr << "Adaptive sampling traces one ray at a time; " << (wavefront ? "--wavefront" : "--packets")
+                      << " is ignored\n";
+            packet_tracing = false;
+            wavefront = false;
+        }
+    }
 
     void initialize()
     {
         image_height = static_cast<int>(image_width / aspect_ratio);
         image_height = (image_height < 1) ? 1 : image_height;
 
-        center = point3(0, 0, 0);
-
-        // Declare sf::Image before usage
-        sf::Image backgroundImage;
-        backgroundImage.create(image_width, image_height, sf::Color::Black);
+        film.resize(image_width, image_height);
 
         center = lookfrom;
 
         auto theta = degrees_to_radians(vfov);
         auto h = tan(theta / 2);
-        auto viewport_height = 2 * h * focus_dist;
-        auto viewport_width = viewport_height * (static_cast<double>(image_width) / image_height);
+        auto viewport_height = real(2 * h * focus_dist);
+        auto viewport_width = real(viewport_height * (static_cast<double>(image_width) / image_height));
 
         w = unit_vector(lookfrom - lookat);
         u = unit_vector(cross(vup, w));
@@ -224,10 +1013,10 @@ private:
         pixel_delta_v = viewport_v / image_height;
 
         auto viewport_upper_left =
-            center - (focus_dist * w) - viewport_u / 2 - viewport_v / 2;
-        pixel00_loc = viewport_upper_left + 0.5 * (pixel_delta_u + pixel_delta_v);
+            center - (real(focus_dist) * w) - viewport_u / 2 - viewport_v / 2;
+        pixel00_loc = viewport_upper_left + (pixel_delta_u + pixel_delta_v) / 2;
 
-        auto defocus_radius = focus_dist * tan(degrees_to_radians(defocus_angle / 2));
+        auto defocus_radius = real(focus_dist * tan(degrees_to_radians(defocus_angle / 2)));
         defocus_disk_u = u * defocus_radius;
         defocus_disk_v = v * defocus_radius;
     }
@@ -254,116 +1043,82 @@ private:
 
     vec3 pixel_sample_square() const {
         // Returns a random point in the square surrounding a pixel at the origin.
-        auto u = (static_cast<double>(rand()) / RAND_MAX);
-        auto v = (static_cast<double>(rand()) / RAND_MAX);
+        auto u = real(random_double());
+        auto v = real(random_double());
         return (u * pixel_delta_u) + (v * pixel_delta_v);
     }
 
 
     color ray_color(const ray& r, int depth, const hittable& world) const
     {
-        hit_record rec;
+        // Follows the path iteratively, carrying the product of the attenuations so far.
+        color throughput(1, 1, 1);
+        ray current = r;
 
-        if (depth <= 0)
+        for (int bounce = 0; bounce < depth; ++bounce)
         {
-            return color(0,0,0);
-        }
+            hit_record rec;
+            thread_counters().count_rays(bounce);
 
-        if (world.hit(r, interval(0.001, infinity), rec)) 
-        {
-            ray scattered;
-            color attenuation;
-            if (rec.mat->scatter(r, rec, attenuation, scattered))
-                return attenuation * ray_color(scattered, depth - 1, world);
-            return color(0, 0, 0);
-        }
+            // Scattered rays start just off the surface (hit_record::spawn_point), so hits at
+            // any positive distance are real.
+            if (!world.hit(current, interval(0, infinity), rec))
+            {
+                RT_COUNT(thread_counters().escaped++);
+                return throughput * background(current);
+            }
 
-        vec3 unit_direction = unit_vector(r.direction());
-        auto a = 0.5 * (unit_direction.y() + 1.0);
+            if (!scatter(current, throughput, rec, bounce))
+                return color(0, 0, 0);
+        }
 
-        // Declare sf::Image before usage
-        //sf::Image backgroundImage;
-        return (1.0 - a) * color(1.0, 1.0, 1.0) + a * color(0.5, 0.7, 1.0);
+        RT_COUNT(thread_counters().depth_limit++);
+        return color(0, 0, 0);
     }
-};
-
-
-#endif // !CAMERA_H
 
-
-//REPLACE RENDER FUNCTION IF YOU WANT FASTER RENDERING
-//CANNOT SEE IN REAL TIME
-/*
-void render(const hittable& world)
+    bool scatter(ray& current, color& throughput, const hit_record& rec, int bounce) const
     {
-        initialize();
-
-        // Declare sf::Image before usage
-        sf::Image backgroundImage;
-        backgroundImage.create(image_width, image_height, sf::Color::Black);
-
-        std::cout << image_width << "px by " << image_height << "px\n";
-
-        // create the window
-        std::cout << "\rWindow will open when calculation have completed " << std::endl;
-
-        std::vector<std::thread> threads;
-        const int num_threads = std::thread::hardware_concurrency();
-
-        for (int t = 0; t < num_threads; ++t)
+        // Continues the path from a hit: replaces `current` with the scattered ray and folds
+        // the attenuation into `throughput`. Returns false when the path ends here.
+        ray scattered;
+        color attenuation;
+        if (!scatter_material(*rec.mat, current, rec, attenuation, scattered))
         {
-            threads.emplace_back([this, &world, t, num_threads, &backgroundImage]() {
-                for (int j = t; j < image_height; j += num_threads)
-                {
-                    std::clog << "\rScanlines remaining: " << (image_height - j) << ' ' << std::flush;
-                    for (int i = 0; i < image_width; ++i)
-                    {
-                        color pixel_color(0, 0, 0);
-                        for (int sample = 0; sample < samples_per_pixel; ++sample) {
-                            ray r = get_ray(i, j);
-                            pixel_color += ray_color(r, max_depth, world);
-                        }
-
-                        sf::Color sfml_color = to_sfml_color(pixel_color, samples_per_pixel);
-                        backgroundImage.setPixel(i, j, sfml_color);
-                    }
-                }
-                });
+            RT_COUNT(thread_counters().absorbed++);
+            return false;
         }
 
-        for (auto& thread : threads)
-        {
-            thread.join();
-        }
-
-        std::clog << "\rDone.                 \n";
-
-        sf::RenderWindow window(sf::VideoMode(800, 450), "Ray Tracer");
+        return continue_path(current, throughput, scattered, attenuation, bounce);
+    }
 
-        // Create a texture and sprite to display the image
-        sf::Texture backgroundTexture;
-        backgroundTexture.loadFromImage(backgroundImage);
-        sf::Sprite backgroundSprite(backgroundTexture);
+    bool continue_path(ray& current, color& throughput, const ray& scattered, const color& attenuation, int bounce) const
+    {
+        // Follows a scatter event and applies Russian roulette. Returns false when the path ends.
+        throughput = throughput * attenuation;
+        current = scattered;
 
-        // Main loop
-        while (window.isOpen())
+        if (russian_roulette && bounce + 1 >= rr_min_depth)
         {
-            // Handle events
-            sf::Event event;
-            while (window.pollEvent(event))
+            // Continue with probability equal to the largest throughput component and
+            // reweight survivors, which keeps the estimate unbiased.
+            auto survive = fmin(fmax(throughput.x(), fmax(throughput.y(), throughput.z())), real(1));
+            if (random_double() >= survive)
             {
-                if (event.type == sf::Event::Closed)
-                    window.close();
+                RT_COUNT(thread_counters().roulette++);
+                return false;
             }
+            throughput /= survive;
+        }
+        return true;
+    }
 
-            // Clear the window
-            window.clear();
+    color background(const ray& r) const
+    {
+        vec3 unit_direction = unit_vector(r.direction());
+        auto a = (unit_direction.y() + 1) / 2;
+        return (1 - a) * color(1, 1, 1) + a * color(real(0.5), real(0.7), 1);
+    }
+};
 
-            // Draw the background sprite
-            window.draw(backgroundSprite);
 
-            // Display the contents of the window
-            window.display();
-        }
-    }
-*/
+#endif // !CAMERA_H
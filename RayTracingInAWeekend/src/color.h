@@ -6,15 +6,21 @@
 
 using color = vec3;
 
-inline double linear_to_gamma(double linear_component)
+inline real linear_to_gamma(real linear_component)
 {
     return sqrt(linear_component);
 }
 
+inline double luminance(const color& c)
+{
+    // Rec. 709 luma weights for linear RGB.
+    return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+}
+
 sf::Color to_sfml_color(const color& pixel_color, int samples_per_pixel)
 {
     // Divide the color by the number of samples.
-    auto scale = 1.0 / samples_per_pixel;
+    real scale = real(1) / samples_per_pixel;
     auto r = pixel_color.x() * scale;
     auto g = pixel_color.y() * scale;
     auto b = pixel_color.z() * scale;
@@ -25,7 +31,7 @@ sf::Color to_sfml_color(const color& pixel_color, int samples_per_pixel)
     b = linear_to_gamma(b);
 
     // Write the translated [0,255] value of each color component.
-    static const interval intensity(0.000, 0.999);
+    static const interval intensity(0, real(0.999));
 
     return sf::Color(
         static_cast<sf::Uint8>(256 * intensity.clamp(r)),
@@ -5,11 +5,17 @@
 #include <limits>
 #include <memory>
 
+#include "precision.h"
+#include "rng.h"
+
 // Usings
 
 using std::shared_ptr;
 using std::make_shared;
 using std::sqrt;
+using std::fabs;
+using std::fmin;
+using std::fmax;
 
 // Constants
 
@@ -26,8 +32,8 @@ inline double degrees_to_radians(double degrees)
 }
 
 inline double random_double() {
-	// Returns a random real in [0,1).
-	return rand() / (RAND_MAX + 1.0);
+	// Returns a random real in [0,1) from the calling thread's generator.
+	return thread_rng().next_double();
 }
 
 inline double random_double(double min, double max) {
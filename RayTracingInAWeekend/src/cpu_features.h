@@ -0,0 +1,90 @@
+#ifndef CPU_FEATURES_H
+#define CPU_FEATURES_H
+
+// Runtime detection of the x86 vector extensions the SIMD kernels can use. Kernels are compiled
+// for their instruction set with RT_TARGET and only called when the running CPU supports it, so
+// one binary runs everywhere.
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define RT_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#else
+#define RT_X86 0
+#endif
+
+#if defined(_MSC_VER) && !defined(__clang__)
+// MSVC accepts every intrinsic in any function.
+#define RT_TARGET(isa)
+#else
+#define RT_TARGET(isa) __attribute__((target(isa)))
+#endif
+
+enum class simd_level
+{
+    scalar,
+    sse2,
+    avx2,
+    avx512
+};
+
+inline const char* simd_level_name(simd_level level)
+{
+    switch (level)
+    {
+    case simd_level::sse2:   return "SSE2";
+    case simd_level::avx2:   return "AVX2";
+    case simd_level::avx512: return "AVX-512";
+    default:                 return "scalar";
+    }
+}
+
+inline simd_level detect_simd_level()
+{
+#if RT_X86 && defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    int max_leaf = info[0];
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+
+    // The OS must also save the wider registers on context switches.
+    unsigned long long xcr0 = osxsave ? _xgetbv(0) : 0;
+    bool ymm_state = (xcr0 & 0x6) == 0x6;
+    bool zmm_state = (xcr0 & 0xe6) == 0xe6;
+
+    bool avx2 = false;
+    bool avx512 = false;
+    if (max_leaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0 && ymm_state;
+        avx512 = (info[1] & (1 << 16)) != 0 && zmm_state;
+    }
+
+    if (avx512) return simd_level::avx512;
+    if (avx2) return simd_level::avx2;
+    if (sse2) return simd_level::sse2;
+    return simd_level::scalar;
+#elif RT_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) return simd_level::avx512;
+    if (__builtin_cpu_supports("avx2")) return simd_level::avx2;
+    if (__builtin_cpu_supports("sse2")) return simd_level::sse2;
+    return simd_level::scalar;
+#else
+    return simd_level::scalar;
+#endif
+}
+
+inline simd_level cpu_simd_level()
+{
+    static const simd_level level = detect_simd_level();
+    return level;
+}
+
+#endif // !CPU_FEATURES_H
@@ -0,0 +1,77 @@
+#ifndef DISPATCH_H
+#define DISPATCH_H
+
+#include "common.h"
+
+#include "color.h"
+#include "hittable.h"
+#include "material.h"
+#include "render_stats.h"
+#include "sphere.h"
+
+// How the hot loops call into primitives and materials.
+//
+// RT_DEVIRTUALIZE 1 treats sphere, lambertian, metal and dielectric as a closed set: the type
+// tag stored in the base class selects a qualified, non-virtual call the compiler can inline,
+// and only other types go through the vtable. The four classes are final, so no subclass can
+// inherit a tag that would skip its own overrides. 0, the default, uses plain virtual calls;
+// with g++ the two measured the same. Define it on the compiler command line
+// (e.g. /DRT_DEVIRTUALIZE=1) to compare them in renders; --bench-dispatch times
+// hit_closed_set() and scatter_closed_set() against virtual calls in any build.
+#ifndef RT_DEVIRTUALIZE
+#define RT_DEVIRTUALIZE 0
+#endif
+
+inline bool hit_closed_set(const hittable& object, const ray& r, interval ray_t, hit_record& rec)
+{
+    if (object.kind() == hittable_kind::sphere)
+        return static_cast<const sphere&>(object).sphere::hit(r, ray_t, rec);
+    return object.hit(r, ray_t, rec);
+}
+
+inline bool scatter_closed_set(const material& mat, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
+{
+    switch (mat.kind())
+    {
+    case material_kind::lambertian:
+        return static_cast<const lambertian&>(mat).lambertian::scatter(r_in, rec, attenuation, scattered);
+    case material_kind::metal:
+        return static_cast<const metal&>(mat).metal::scatter(r_in, rec, attenuation, scattered);
+    case material_kind::dielectric:
+        return static_cast<const dielectric&>(mat).dielectric::scatter(r_in, rec, attenuation, scattered);
+    default:
+        return mat.scatter(r_in, rec, attenuation, scattered);
+    }
+}
+
+inline bool hit_object(const hittable& object, const ray& r, interval ray_t, hit_record& rec)
+{
+    RT_COUNT(thread_counters().primitive_tests += object.kind() != hittable_kind::aggregate);
+#if RT_DEVIRTUALIZE
+    return hit_closed_set(object, r, ray_t, rec);
+#else
+    return object.hit(r, ray_t, rec);
+#endif
+}
+
+inline int hit_object_packet(const hittable& object, ray_packet& packet, double t_min, int active, hit_record* recs)
+{
+    RT_COUNT(thread_counters().primitive_tests += object.kind() != hittable_kind::aggregate ? ray_packet::lane_count(active) : 0);
+#if RT_DEVIRTUALIZE
+    if (object.kind() == hittable_kind::sphere)
+        return static_cast<const sphere&>(object).sphere::hit_packet(packet, t_min, active, recs);
+#endif
+    return object.hit_packet(packet, t_min, active, recs);
+}
+
+inline bool scatter_material(const material& mat, const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
+{
+    RT_COUNT(thread_counters().scatters[static_cast<int>(mat.kind())]++);
+#if RT_DEVIRTUALIZE
+    return scatter_closed_set(mat, r_in, rec, attenuation, scattered);
+#else
+    return mat.scatter(r_in, rec, attenuation, scattered);
+#endif
+}
+
+#endif // !DISPATCH_H
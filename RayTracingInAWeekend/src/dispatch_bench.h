@@ -0,0 +1,144 @@
+#ifndef DISPATCH_BENCH_H
+#define DISPATCH_BENCH_H
+
+#include "common.h"
+
+#include "camera.h"
+#include "dispatch.h"
+#include "hittable_list.h"
+#include "scenes.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+// Virtual calls against the closed-set switch of dispatch.h (RT_DEVIRTUALIZE 1), in the same
+// build. The hit loop tests rays against every sphere of the random spheres scene through a
+// hittable reference, as the leaf loops do; the scatter loop scatters off records whose
+// materials come from those spheres in random order, as the camera's shading step sees them.
+// Both loops of a pair do the same work with the same random streams, so only the call differs.
+
+class dispatch_bench
+{
+public:
+    int ray_count = 4096;           // Against the scene's ~490 spheres: about 2M hit tests a loop
+    int scatter_count = 200000;
+    int repetitions = 7;            // Best of, per loop
+
+    void run(std::ostream& log)
+    {
+        hittable_list world;
+        camera cam;
+        random_spheres_scene(world, cam);
+        for (const auto& object : world.objects)
+        {
+            objects.push_back(object.get());
+            auto s = std::dynamic_pointer_cast<sphere>(object);
+            if (s)
+                spheres.push_back(s);
+        }
+        this->world = world;
+
+        for (int k = 0; k < ray_count; k++)
+        {
+            point3 origin = cam.lookfrom + vec3::random(-1, 1);
+            point3 target(real(random_double(-11, 11)), real(random_double(0, 1)), real(random_double(-11, 11)));
+            rays.push_back(ray(origin, target - origin));
+        }
+
+        // Hits on random spheres, with the ray that made them, so every scatter sees valid input.
+        while (static_cast<int>(records.size()) < scatter_count)
+        {
+            const sphere& s = *spheres[static_cast<size_t>(random_double() * spheres.size())];
+            point3 origin = cam.lookfrom + vec3::random(-1, 1);
+            ray r(origin, s.get_center() - origin);
+            hit_record rec;
+            if (s.sphere::hit(r, interval(0.001, infinity), rec))
+            {
+                records.push_back(rec);
+                record_rays.push_back(r);
+            }
+        }
+
+        log << "Dispatch cost, " << objects.size() << " objects, " << ray_count << " rays, "
+            << scatter_count << " scatters\n";
+        report(log, "hit", time_hits(false), time_hits(true));
+        report(log, "scatter", time_scatters(false), time_scatters(true));
+
+        // Printed so the compiler cannot drop the loops as dead code.
+        log << "checksum " << checksum << '\n';
+    }
+
+private:
+    hittable_list world;        // Keeps the objects and materials alive
+    std::vector<const hittable*> objects;
+    std::vector<shared_ptr<sphere>> spheres;
+    std::vector<ray> rays;
+    std::vector<hit_record> records;
+    std::vector<ray> record_rays;
+    double checksum = 0;
+
+    template <typename Loop>
+    double best_ms(Loop loop)
+    {
+        double best = 0;
+        for (int r = 0; r < repetitions; r++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            checksum += loop();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = r == 0 || elapsed.count() < best ? elapsed.count() : best;
+        }
+        return 1e3 * best;
+    }
+
+    double time_hits(bool closed_set)
+    {
+        return best_ms([this, closed_set]() {
+            double sum = 0;
+            for (const ray& r : rays)
+            {
+                hit_record rec;
+                for (const hittable* object : objects)
+                {
+                    bool hit = closed_set ? hit_closed_set(*object, r, interval(0.001, infinity), rec)
+                                          : object->hit(r, interval(0.001, infinity), rec);
+                    if (hit)
+                        sum += rec.t;
+                }
+            }
+            return sum;
+            });
+    }
+
+    double time_scatters(bool closed_set)
+    {
+        return best_ms([this, closed_set]() {
+            thread_rng() = pcg32();
+            double sum = 0;
+            for (size_t k = 0; k < records.size(); k++)
+            {
+                const hit_record& rec = records[k];
+                color attenuation;
+                ray scattered;
+                bool scatter = closed_set ? scatter_closed_set(*rec.mat, record_rays[k], rec, attenuation, scattered)
+                                          : rec.mat->scatter(record_rays[k], rec, attenuation, scattered);
+                if (scatter)
+                    sum += attenuation.x() + scattered.direction().x();
+            }
+            return sum;
+            });
+    }
+
+    static void report(std::ostream& log, const char* name, double virtual_ms, double switch_ms)
+    {
+        log << "  " << std::left << std::setw(8) << name << std::right << std::fixed << std::setprecision(2)
+            << "virtual " << std::setw(7) << virtual_ms << " ms, switch " << std::setw(7) << switch_ms << " ms ("
+            << switch_ms / virtual_ms << "x)\n";
+        log.unsetf(std::ios_base::floatfield);
+    }
+};
+
+#endif // !DISPATCH_BENCH_H
@@ -0,0 +1,120 @@
+#ifndef FRAMEBUFFER_H
+#define FRAMEBUFFER_H
+
+#include "common.h"
+
+#include "color.h"
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+// Linear HDR accumulation buffer: a running float RGB sum and a sample count per pixel.
+// Nothing is clamped or gamma corrected here; that happens in tonemap_rgba8() when the
+// image is displayed or saved, so more samples can be added at any time.
+class framebuffer
+{
+public:
+    static const int cache_line = 64;
+
+    framebuffer()
+    {
+
+    }
+
+    framebuffer(int w, int h) { resize(w, h); }
+
+    void resize(int w, int h)
+    {
+        // Rows are padded to a whole number of cache lines and the buffer is cache-line
+        // aligned, so threads rendering tiles whose width is a multiple of pixels_per_line
+        // never write to the same line.
+        image_width = w;
+        image_height = h;
+        stride = (w + pixels_per_line - 1) / pixels_per_line * pixels_per_line;
+
+        std::size_t bytes = sizeof(accum_pixel) * stride * h;
+        storage.reset(new unsigned char[bytes + cache_line]);
+        auto address = reinterpret_cast<std::uintptr_t>(storage.get());
+        auto aligned = (address + cache_line - 1) & ~static_cast<std::uintptr_t>(cache_line - 1);
+        pixels = reinterpret_cast<accum_pixel*>(aligned);
+
+        clear();
+    }
+
+    void clear()
+    {
+        if (pixels)
+            std::memset(pixels, 0, sizeof(accum_pixel) * stride * image_height);
+    }
+
+    int width() const { return image_width; }
+    int height() const { return image_height; }
+
+    void add_sample(int i, int j, const color& c)
+    {
+        add_samples(i, j, c, 1);
+    }
+
+    void add_samples(int i, int j, const color& sum, int count)
+    {
+        accum_pixel& p = pixels[i + j * stride];
+        p.r += static_cast<float>(sum.x());
+        p.g += static_cast<float>(sum.y());
+        p.b += static_cast<float>(sum.z());
+        p.count += count;
+    }
+
+    int sample_count(int i, int j) const
+    {
+        return static_cast<int>(pixels[i + j * stride].count);
+    }
+
+    color average(int i, int j) const
+    {
+        const accum_pixel& p = pixels[i + j * stride];
+        if (p.count == 0)
+            return color(0, 0, 0);
+        real scale = real(1) / p.count;
+        return color(p.r * scale, p.g * scale, p.b * scale);
+    }
+
+    void tonemap_rgba8(std::vector<std::uint8_t>& out) const
+    {
+        // Quantizes the per-pixel averages to gamma-corrected 8-bit RGBA, row-major from the
+        // top left, in the layout sf::Image and sf::Texture::update expect.
+        out.resize(4 * static_cast<std::size_t>(image_width) * image_height);
+        for (int j = 0; j < image_height; ++j)
+        {
+            for (int i = 0; i < image_width; ++i)
+            {
+                sf::Color c = to_sfml_color(average(i, j), 1);
+                std::uint8_t* dst = &out[4 * (static_cast<std::size_t>(i) + static_cast<std::size_t>(j) * image_width)];
+                dst[0] = c.r;
+                dst[1] = c.g;
+                dst[2] = c.b;
+                dst[3] = 255;
+            }
+        }
+    }
+
+private:
+    class accum_pixel
+    {
+    public:
+        float r, g, b;
+        std::uint32_t count;
+    };
+
+    static const int pixels_per_line = cache_line / sizeof(accum_pixel);
+
+    int image_width = 0;
+    int image_height = 0;
+    int stride = 0;     // Pixels per row including padding
+
+    std::unique_ptr<unsigned char[]> storage;
+    accum_pixel* pixels = nullptr;
+};
+
+#endif // !FRAMEBUFFER_H
@@ -0,0 +1,92 @@
+#ifndef HEATMAP_H
+#define HEATMAP_H
+
+#include "image_writer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// What each pixel cost to render, written as a false-color image next to the beauty render.
+// Costs span orders of magnitude (sky pixels against defocused glass), so colors follow the
+// logarithm of the cost between its 1st and 99.9th percentile; a .pfm file gets the raw values.
+class cost_map
+{
+public:
+    void resize(int w, int h)
+    {
+        width = w;
+        height = h;
+        cost.assign(static_cast<std::size_t>(w) * h, 0.0f);
+    }
+
+    // Each pixel belongs to one tile, so render threads never write the same entry.
+    void set(int i, int j, double c) { cost[static_cast<std::size_t>(i) + static_cast<std::size_t>(j) * width] = static_cast<float>(c); }
+
+    bool write(const std::string& path, const char* unit, std::ostream& log) const
+    {
+        if (file_extension(path) == "pfm")
+        {
+            std::vector<float> rgb(3 * cost.size());
+            for (std::size_t p = 0; p < cost.size(); ++p)
+                rgb[3 * p + 0] = rgb[3 * p + 1] = rgb[3 * p + 2] = cost[p];
+            return write_pfm(path, width, height, rgb);
+        }
+
+        double lo = percentile(0.01);
+        double hi = percentile(0.999);
+        double log_lo = std::log(std::max(lo, 1e-9));
+        double log_range = std::max(std::log(std::max(hi, 1e-9)) - log_lo, 1e-9);
+
+        std::vector<std::uint8_t> rgba(4 * cost.size());
+        for (std::size_t p = 0; p < cost.size(); ++p)
+        {
+            double x = (std::log(std::max(static_cast<double>(cost[p]), 1e-9)) - log_lo) / log_range;
+            turbo(x, &rgba[4 * p]);
+            rgba[4 * p + 3] = 255;
+        }
+
+        log << "Cost heatmap: " << lo << " (blue) to " << hi << " (red) " << unit
+            << " per pixel, log scale; median " << percentile(0.5) << ", max " << percentile(1) << '\n';
+        return write_image(path, width, height, rgba);
+    }
+
+private:
+    int width = 0;
+    int height = 0;
+    std::vector<float> cost;
+
+    double percentile(double q) const
+    {
+        if (cost.empty())
+            return 0;
+        std::vector<float> sorted(cost);
+        auto k = static_cast<std::size_t>(q * (sorted.size() - 1));
+        std::nth_element(sorted.begin(), sorted.begin() + k, sorted.end());
+        return sorted[k];
+    }
+
+    static void turbo(double x, std::uint8_t* rgb)
+    {
+        // Polynomial fit of the Turbo colormap (Mikhailov, Google AI, 2019): dark blue through
+        // green and yellow to dark red, with even perceived steps.
+        x = x < 0 ? 0 : (x > 1 ? 1 : x);
+        double r = 0.13572138 + x * (4.61539260 + x * (-42.66032258 + x * (132.13108234 + x * (-152.94239396 + x * 59.28637943))));
+        double g = 0.09140261 + x * (2.19418839 + x * (4.84296658 + x * (-14.18503333 + x * (4.27729857 + x * 2.82956604))));
+        double b = 0.10667330 + x * (12.64194608 + x * (-60.58204836 + x * (110.36276771 + x * (-89.90310912 + x * 27.34824973))));
+        rgb[0] = to_byte(r);
+        rgb[1] = to_byte(g);
+        rgb[2] = to_byte(b);
+    }
+
+    static std::uint8_t to_byte(double v)
+    {
+        v = v < 0 ? 0 : (v > 1 ? 1 : v);
+        return static_cast<std::uint8_t>(255 * v + 0.5);
+    }
+};
+
+#endif // !HEATMAP_H
@@ -0,0 +1,152 @@
+#ifndef HIT_BENCH_H
+#define HIT_BENCH_H
+
+#include "common.h"
+
+#include "camera.h"
+#include "hittable_list.h"
+#include "scenes.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <thread>
+#include <vector>
+
+// Intersection cost of hit_record's non-owning material pointer against the shared_ptr it
+// replaced. Both loops test the same rays against the random spheres scene's spheres one by one,
+// as a linear hittable_list does; the shared_ptr loop also copies the material's shared_ptr on
+// each closer hit and again into the result, as sphere::hit and hittable_list::hit used to. The
+// reference count is shared by every thread that hits the sphere, so the difference grows with
+// the thread count as the count's cache line moves between cores.
+
+class hit_bench
+{
+public:
+    int ray_count = 1 << 14;    // Rays per thread per pass
+    int passes = 4;
+    int repetitions = 3;        // Best of, per thread count and loop
+    int max_threads = 0;        // 0 uses std::thread::hardware_concurrency()
+
+    void run(std::ostream& log)
+    {
+        hittable_list world;
+        camera cam;
+        random_spheres_scene(world, cam);
+        for (const auto& object : world.objects)
+        {
+            auto s = std::dynamic_pointer_cast<sphere>(object);
+            if (s)
+                spheres.push_back(s);
+        }
+
+        // Rays from around the camera towards the spheres, the same for every run.
+        for (int k = 0; k < ray_count; k++)
+        {
+            point3 origin = cam.lookfrom + vec3::random(-1, 1);
+            point3 target(real(random_double(-11, 11)), real(random_double(0, 1)), real(random_double(-11, 11)));
+            rays.push_back(ray(origin, target - origin));
+        }
+
+        int threads = max_threads > 0 ? max_threads : static_cast<int>(std::thread::hardware_concurrency());
+        threads = std::max(threads, 1);
+        log << "Intersection cost, " << spheres.size() << " spheres, " << ray_count << " rays per thread\n";
+        for (int t = 1; t <= threads; t = t < threads ? std::min(2 * t, threads) : threads + 1)
+        {
+            double pointer_ns = time_per_ray(t, false);
+            double owning_ns = time_per_ray(t, true);
+            log << "  " << std::setw(3) << t << " threads: " << std::fixed << std::setprecision(1)
+                << "raw pointer " << pointer_ns << " ns/ray, shared_ptr " << owning_ns << " ns/ray ("
+                << std::setprecision(2) << owning_ns / pointer_ns << "x)\n";
+            log.unsetf(std::ios_base::floatfield);
+        }
+
+        // Printed so the compiler cannot drop the loops as dead code.
+        log << "checksum " << checksum << '\n';
+    }
+
+private:
+    class owning_record
+    {
+    public:
+        hit_record rec;
+        shared_ptr<material> mat;
+    };
+
+    std::vector<shared_ptr<sphere>> spheres;
+    std::vector<ray> rays;
+    double checksum = 0;
+
+    double time_per_ray(int threads, bool owning)
+    {
+        double best = 0;
+        for (int r = 0; r < repetitions; r++)
+        {
+            std::vector<double> sums(threads, 0.0);
+            auto start = std::chrono::steady_clock::now();
+            std::vector<std::thread> workers;
+            for (int t = 0; t < threads; t++)
+                workers.emplace_back([&, t]() { sums[t] = owning ? trace_owning() : trace_pointer(); });
+            for (auto& w : workers)
+                w.join();
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+            for (double s : sums)
+                checksum += s;
+            best = r == 0 || elapsed.count() < best ? elapsed.count() : best;
+        }
+        // Time per ray on each thread: flat while the threads scale.
+        return 1e9 * best / (static_cast<double>(passes) * rays.size());
+    }
+
+    double trace_pointer() const
+    {
+        double sum = 0;
+        for (int p = 0; p < passes; p++)
+        {
+            for (const ray& r : rays)
+            {
+                hit_record temp, best;
+                real closest = infinity;
+                for (const auto& s : spheres)
+                {
+                    if (s->sphere::hit(r, interval(0, closest), temp))
+                    {
+                        closest = temp.t;
+                        best = temp;
+                    }
+                }
+                sum += closest < infinity ? static_cast<double>(closest) + (best.mat != nullptr) : 0;
+            }
+        }
+        return sum;
+    }
+
+    double trace_owning() const
+    {
+        double sum = 0;
+        for (int p = 0; p < passes; p++)
+        {
+            for (const ray& r : rays)
+            {
+                owning_record temp, best;
+                real closest = infinity;
+                for (const auto& s : spheres)
+                {
+                    if (s->sphere::hit(r, interval(0, closest), temp.rec))
+                    {
+                        temp.mat = s->get_material();
+                        closest = temp.rec.t;
+                        best = temp;
+                    }
+                }
+                sum += closest < infinity ? static_cast<double>(closest) + (best.mat != nullptr) : 0;
+            }
+        }
+        return sum;
+    }
+};
+
+#endif // !HIT_BENCH_H
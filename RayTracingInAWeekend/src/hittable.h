@@ -1,7 +1,12 @@
 #ifndef HITTABLE_H
 #define HITTABLE_H
 
+#include "aabb.h"
 #include "ray.h"
+#include "ray_packet.h"
+
+#include <functional>
+#include <limits>
 
 class material;
 
@@ -10,10 +15,22 @@ class hit_record
   public:
     point3 p;
     vec3 normal;
-    shared_ptr<material> mat;
-    double t;
+    const material* mat = nullptr;  // Non-owning; the primitive that was hit keeps its material alive.
+    real t;
     bool front_face;
 
+    point3 spawn_point(const vec3& direction) const {
+        // Origin for a ray leaving the surface in `direction`: the hit point pushed off the
+        // surface to the side the ray leaves from. The margin grows with the magnitude of the
+        // point, like its rounding error, so the new ray cannot hit the surface it starts on
+        // and no minimum hit distance is needed. 1024 ulps covers the error of a float hit on
+        // the scene's radius-1000 ground sphere.
+        const real relative = 1024 * std::numeric_limits<real>::epsilon();
+        real scale = fmax(fmax(fabs(p.x()), fabs(p.y())), fabs(p.z()));
+        real offset = relative * (1 + scale);
+        return dot(direction, normal) > 0 ? p + offset * normal : p - offset * normal;
+    }
+
     void set_face_normal(const ray& r, const vec3& outward_normal) {
         // Sets the hit record normal vector.
         // NOTE: the parameter `outward_normal` is assumed to have unit length.
@@ -23,12 +40,59 @@ class hit_record
     }
 };
 
+// Built-in hittables that dispatch.h can intersect without a virtual call, and aggregates:
+// objects that only hold other objects (lists, BVHs, instances, meshes, batches), which count
+// the primitives they test themselves instead of being counted as one.
+enum class hittable_kind
+{
+	sphere,
+	aggregate,
+	other
+};
+
 class hittable
 {
 public:
 	virtual ~hittable() = default;
 
+	hittable_kind kind() const { return tag; }
+
 	virtual bool hit(const ray& r, interval ray_t, hit_record& rec) const = 0;
+
+	// Intersects the rays of `packet` selected by `active` over (t_min, packet.t_max[k]). Each
+	// ray that finds a closer hit gets recs[k] filled and t_max[k] lowered; the returned mask
+	// holds those rays. The default traces the rays one at a time.
+	virtual int hit_packet(ray_packet& packet, double t_min, int active, hit_record* recs) const
+	{
+		int mask = 0;
+		for (int k = 0; k < packet.size; k++)
+		{
+			if ((active & (1 << k)) && hit(packet.get(k), interval(real(t_min), real(packet.t_max[k])), recs[k]))
+			{
+				packet.t_max[k] = recs[k].t;
+				mask |= 1 << k;
+			}
+		}
+		return mask;
+	}
+
+	virtual aabb bounding_box() const = 0;
+
+	// Calls visit() on each object this one is made of, for passes over a whole scene such as
+	// building its meshes' BVHs. Aggregates override it; primitives have none.
+	virtual void visit_children(const std::function<void(hittable&)>&) const
+	{
+
+	}
+
+protected:
+	hittable(hittable_kind k = hittable_kind::other) : tag(k)
+	{
+
+	}
+
+private:
+	hittable_kind tag;
 };
 
 #endif
\ No newline at end of file
@@ -1,6 +1,7 @@
 #ifndef HITTABLE_LIST_H
 #define HITTABLE_LIST_H
 
+#include "dispatch.h"
 #include "hittable.h"
 
 #include <memory>
@@ -15,17 +16,19 @@ public:
 	std::vector<shared_ptr<hittable>> objects;
 
 	hittable_list()
+		: hittable(hittable_kind::aggregate)
 	{
 
 	}
 
-	hittable_list(shared_ptr<hittable> object) { add(object); }
+	hittable_list(shared_ptr<hittable> object) : hittable(hittable_kind::aggregate) { add(object); }
 
-	void clear() { objects.clear(); }
+	void clear() { objects.clear(); bbox = aabb(); }
 
 	void add(shared_ptr<hittable> object)
 	{
 		objects.push_back(object);
+		bbox = aabb(bbox, object->bounding_box());
 	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
@@ -36,7 +39,7 @@ public:
 
 		for (const auto& object : objects) 
 		{
-			if (object->hit(r, interval(ray_t.min, closest_so_far), temp_rec))
+			if (hit_object(*object, r, interval(ray_t.min, closest_so_far), temp_rec))
 			{
 				hit_anything = true;
 				closest_so_far = temp_rec.t;
@@ -46,6 +49,27 @@ public:
 
 		return hit_anything;
 	}
+
+	int hit_packet(ray_packet& packet, double t_min, int active, hit_record* recs) const override
+	{
+		// Each object only reports hits closer than the packet's current t_max, so the last
+		// hit recorded for a ray is its closest.
+		int mask = 0;
+		for (const auto& object : objects)
+			mask |= hit_object_packet(*object, packet, t_min, active, recs);
+		return mask;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	void visit_children(const std::function<void(hittable&)>& visit) const override
+	{
+		for (const auto& object : objects)
+			visit(*object);
+	}
+
+private:
+	aabb bbox;
 };
 
 #endif // !1
@@ -0,0 +1,120 @@
+#ifndef IMAGE_COMPARE_H
+#define IMAGE_COMPARE_H
+
+#include "framebuffer.h"
+
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Compares a render with a reference PFM written by an earlier run, e.g. a double precision
+// build against a float one, or a new acceleration structure against the linear scan.
+
+class pfm_image
+{
+public:
+    int width = 0;
+    int height = 0;
+    std::vector<float> rgb;     // Linear RGB, row-major from the top left like the framebuffer
+};
+
+inline bool read_pfm(const std::string& path, pfm_image& image)
+{
+    // Reads the color PFMs write_pfm produces: "PF", width, height, then a scale whose sign
+    // gives the byte order, and float rows stored bottom to top.
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+        return false;
+
+    std::string magic;
+    double scale = 0;
+    in >> magic >> image.width >> image.height >> scale;
+    if (!in || magic != "PF" || image.width <= 0 || image.height <= 0 || scale == 0)
+        return false;
+    in.get();   // The single whitespace character before the data
+
+    const std::uint16_t probe = 1;
+    bool little_endian = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+    bool swap = (scale < 0) != little_endian;
+
+    std::size_t row_floats = 3 * static_cast<std::size_t>(image.width);
+    image.rgb.resize(row_floats * image.height);
+    for (int j = image.height - 1; j >= 0; --j)
+    {
+        float* row = &image.rgb[row_floats * j];
+        in.read(reinterpret_cast<char*>(row), row_floats * sizeof(float));
+        if (swap)
+        {
+            for (std::size_t k = 0; k < row_floats; ++k)
+            {
+                auto bytes = reinterpret_cast<unsigned char*>(&row[k]);
+                std::swap(bytes[0], bytes[3]);
+                std::swap(bytes[1], bytes[2]);
+            }
+        }
+    }
+    return static_cast<bool>(in);
+}
+
+class image_difference
+{
+public:
+    double rmse = 0;            // Root mean square difference of the linear channel values
+    double psnr = 0;            // 20 log10(1 / rmse) in dB, infinite for identical images
+    double max_abs = 0;         // Largest difference of any linear channel value
+    double changed_8bit = 0;    // Percentage of pixels whose displayed 8-bit color differs
+
+    void print(std::ostream& out) const
+    {
+        out << "RMSE " << rmse << ", PSNR " << psnr << " dB, max difference " << max_abs
+            << ", " << changed_8bit << "% of pixels differ in 8-bit\n";
+    }
+};
+
+inline int displayed_8bit(double linear)
+{
+    // The value to_sfml_color shows for a linear channel value.
+    double v = std::sqrt(linear > 0 ? linear : 0);
+    return static_cast<int>(256 * (v < 0.999 ? v : 0.999));
+}
+
+inline bool compare_images(const framebuffer& fb, const pfm_image& reference, image_difference& diff)
+{
+    if (fb.width() != reference.width || fb.height() != reference.height)
+        return false;
+
+    double sum_squares = 0;
+    std::size_t changed = 0;
+    diff.max_abs = 0;
+    for (int j = 0; j < fb.height(); ++j)
+    {
+        for (int i = 0; i < fb.width(); ++i)
+        {
+            color c = fb.average(i, j);
+            const float* ref = &reference.rgb[3 * (static_cast<std::size_t>(i) + static_cast<std::size_t>(j) * fb.width())];
+            bool pixel_changed = false;
+            for (int k = 0; k < 3; ++k)
+            {
+                // Both sides go through float, as they do in the PFM.
+                double value = static_cast<float>(c[k]);
+                double d = std::fabs(value - ref[k]);
+                sum_squares += d * d;
+                diff.max_abs = d > diff.max_abs ? d : diff.max_abs;
+                pixel_changed |= displayed_8bit(value) != displayed_8bit(ref[k]);
+            }
+            changed += pixel_changed;
+        }
+    }
+
+    double pixels = static_cast<double>(fb.width()) * fb.height();
+    diff.rmse = std::sqrt(sum_squares / (3 * pixels));
+    diff.psnr = diff.rmse > 0 ? 20 * std::log10(1 / diff.rmse) : infinity;
+    diff.changed_8bit = 100.0 * changed / pixels;
+    return true;
+}
+
+#endif // !IMAGE_COMPARE_H
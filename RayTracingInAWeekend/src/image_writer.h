@@ -0,0 +1,128 @@
+#ifndef IMAGE_WRITER_H
+#define IMAGE_WRITER_H
+
+#include "framebuffer.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <SFML/Graphics/Image.hpp>
+
+// Writers for the renderer's accumulation buffer. The 8-bit formats go through
+// framebuffer::tonemap_rgba8; PFM stores the linear averages.
+
+inline bool write_ppm(const std::string& path, int width, int height, const std::vector<std::uint8_t>& rgba)
+{
+    // Binary 8-bit PPM from row-major RGBA; alpha is dropped.
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+
+    out << "P6\n" << width << ' ' << height << "\n255\n";
+    std::vector<char> rgb(3 * rgba.size() / 4);
+    for (std::size_t p = 0; p < rgba.size() / 4; ++p)
+    {
+        rgb[3 * p + 0] = static_cast<char>(rgba[4 * p + 0]);
+        rgb[3 * p + 1] = static_cast<char>(rgba[4 * p + 1]);
+        rgb[3 * p + 2] = static_cast<char>(rgba[4 * p + 2]);
+    }
+    out.write(rgb.data(), rgb.size());
+    return static_cast<bool>(out);
+}
+
+inline bool write_ppm(const std::string& path, const framebuffer& fb)
+{
+    // Gamma corrected like the window output.
+    std::vector<std::uint8_t> rgba;
+    fb.tonemap_rgba8(rgba);
+    return write_ppm(path, fb.width(), fb.height(), rgba);
+}
+
+inline bool write_pfm(const std::string& path, int width, int height, const std::vector<float>& rgb)
+{
+    // Portable float map: linear 32-bit RGB with no clamping, so the HDR values survive.
+    // `rgb` is row-major from the top left; PFM rows are stored bottom to top, and a negative
+    // scale marks little-endian data.
+    std::ofstream out(path, std::ios::binary);
+    if (!out)
+        return false;
+
+    const std::uint16_t probe = 1;
+    bool little_endian = *reinterpret_cast<const unsigned char*>(&probe) == 1;
+
+    out << "PF\n" << width << ' ' << height << '\n' << (little_endian ? "-1.0" : "1.0") << '\n';
+    std::size_t row_floats = 3 * static_cast<std::size_t>(width);
+    for (int j = height - 1; j >= 0; --j)
+        out.write(reinterpret_cast<const char*>(&rgb[row_floats * j]), row_floats * sizeof(float));
+    return static_cast<bool>(out);
+}
+
+inline bool write_pfm(const std::string& path, const framebuffer& fb)
+{
+    // The per-pixel averages.
+    std::vector<float> rgb(3 * static_cast<std::size_t>(fb.width()) * fb.height());
+    for (int j = 0; j < fb.height(); ++j)
+    {
+        for (int i = 0; i < fb.width(); ++i)
+        {
+            color c = fb.average(i, j);
+            float* dst = &rgb[3 * (static_cast<std::size_t>(i) + static_cast<std::size_t>(j) * fb.width())];
+            dst[0] = static_cast<float>(c.x());
+            dst[1] = static_cast<float>(c.y());
+            dst[2] = static_cast<float>(c.z());
+        }
+    }
+    return write_pfm(path, fb.width(), fb.height(), rgb);
+}
+
+inline bool write_sfml(const std::string& path, int width, int height, const std::vector<std::uint8_t>& rgba)
+{
+    // PNG, BMP, TGA and JPG go through sf::Image, which needs no window or display.
+    sf::Image image;
+    image.create(width, height, rgba.data());
+    return image.saveToFile(path);
+}
+
+inline bool write_sfml(const std::string& path, const framebuffer& fb)
+{
+    std::vector<std::uint8_t> rgba;
+    fb.tonemap_rgba8(rgba);
+    return write_sfml(path, fb.width(), fb.height(), rgba);
+}
+
+inline std::string file_extension(const std::string& path)
+{
+    // Lower case, without the dot.
+    std::string ext;
+    auto dot = path.find_last_of('.');
+    if (dot != std::string::npos)
+        ext = path.substr(dot + 1);
+    std::transform(ext.begin(), ext.end(), ext.begin(),
+        [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+    return ext;
+}
+
+inline bool write_image(const std::string& path, int width, int height, const std::vector<std::uint8_t>& rgba)
+{
+    // 8-bit RGBA in any format but PFM, picked from the file extension.
+    if (file_extension(path) == "ppm")
+        return write_ppm(path, width, height, rgba);
+    return write_sfml(path, width, height, rgba);
+}
+
+inline bool write_image(const std::string& path, const framebuffer& fb)
+{
+    // Picks the format from the file extension.
+    std::string ext = file_extension(path);
+
+    if (ext == "ppm")
+        return write_ppm(path, fb);
+    if (ext == "pfm")
+        return write_pfm(path, fb);
+    return write_sfml(path, fb);
+}
+
+#endif // !IMAGE_WRITER_H
@@ -0,0 +1,54 @@
+#ifndef INSTANCE_H
+#define INSTANCE_H
+
+#include "common.h"
+
+#include "hittable.h"
+#include "material.h"
+#include "transform.h"
+
+// A placed copy of shared geometry: any hittable, usually a BVH over a mesh or a group of
+// objects, seen through an affine transform and optionally drawn with another material. Many
+// instances share one object, so repeating a complex object costs one instance each rather
+// than a copy of its geometry. A BVH over the instances makes a two-level structure: the top
+// level finds instances, and each instance's own BVH finds its primitives.
+//
+// Only the world-to-object transform is kept. Rays are carried into object space without
+// renormalizing the direction, so hit distances are the same in both spaces; the hit point is
+// then taken on the world ray, and normals go back through the inverse transpose.
+class instance : public hittable
+{
+public:
+    instance(shared_ptr<hittable> _object, const affine_transform& to_world, shared_ptr<material> _material = nullptr)
+        : hittable(hittable_kind::aggregate), object(_object), to_object(to_world.inverse()), mat(_material)
+    {
+        bbox = to_world.apply_box(object->bounding_box());
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        ray local(to_object.apply_point(r.origin()), to_object.apply_vector(r.direction()));
+        if (!object->hit(local, ray_t, rec))
+            return false;
+
+        // The object faced its normal against the local ray, and the inverse transpose keeps
+        // that orientation, so front_face stays valid.
+        rec.p = r.at(rec.t);
+        rec.normal = unit_vector(to_object.apply_transposed(rec.normal));
+        if (mat)
+            rec.mat = mat.get();
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    void visit_children(const std::function<void(hittable&)>& visit) const override { visit(*object); }
+
+private:
+    shared_ptr<hittable> object;
+    affine_transform to_object;
+    shared_ptr<material> mat;   // Replaces the object's materials when set
+    aabb bbox;
+};
+
+#endif // !INSTANCE_H
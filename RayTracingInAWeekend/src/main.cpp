@@ -1,75 +1,254 @@
 #include "common.h"
 
+#include "benchmark.h"
 #include "camera.h"
-#include "color.h"
+#include "dispatch_bench.h"
+#include "hit_bench.h"
 #include "hittable_list.h"
-#include "material.h"
-#include "sphere.h"
+#include "refit_bench.h"
+#include "scenes.h"
+#include "vec3_bench.h"
 
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <thread>
 
-int main()
+
+int main(int argc, char* argv[])
 {
-    hittable_list world;
+    // A benchmark run starts from the benchmark's defaults instead of the full-size render's.
+    bool benchmark = false;
+    for (int i = 1; i < argc; ++i)
+        benchmark |= std::string(argv[i]) == "--benchmark";
+    benchmark_options bench_options;
+
+    camera cam;
+
+    cam.aspect_ratio = 16.0 / 9.0;
+    cam.image_width = 1200;
+    cam.samples_per_pixel = 100;
+    cam.max_depth = 50;
 
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
-
-    for (int a = -11; a < 11; a++) {
-        for (int b = -11; b < 11; b++) {
-            auto choose_mat = random_double();
-            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
-
-            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
-                shared_ptr<material> sphere_material;
-
-                if (choose_mat < 0.8) {
-                    // diffuse
-                    auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else if (choose_mat < 0.95) {
-                    // metal
-                    auto albedo = color::random(0.5, 1);
-                    auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
-                else {
-                    // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
-                }
+    cam.fastRender = true;
+
+    if (benchmark)
+    {
+        cam.image_width = bench_options.image_width;
+        cam.samples_per_pixel = bench_options.samples_per_pixel;
+        cam.max_depth = bench_options.max_depth;
+    }
+
+    // One of scene_names(): random_spheres, dense_spheres, glass, mesh, large_mesh or instances.
+    std::string scene = "random_spheres";
+
+    // How rays find the nearest object: linear (test every object), bvh (binary), bvh4 or bvh8
+    // (wide BVH with SIMD child tests), or batch (every sphere in one SIMD sphere_batch).
+    std::string accel = "bvh4";
+
+    // How BVHs are built: sah (slower build, faster rays) or lbvh (Morton-code sort, fast rebuilds).
+    bvh_build build = bvh_build::sah;
+
+    // OBJ file to render instead of a built-in scene.
+    std::string obj_file;
+
+    // Runs the intersection cost benchmark instead of rendering.
+    bool hit_benchmark = false;
+
+    // Frames of the refit benchmark, 0 renders instead.
+    int refit_frames = 0;
+
+    // Chrome trace of scene setup, tiles per worker thread, display updates and file output.
+    std::string trace_file;
+
+    // Command line overrides, so renders can be scripted on machines without a display:
+    //   --headless  --progressive  --packets  --wavefront  --adaptive <threshold>  --min-spp <n>  --accel <name>
+    //   --build <sah|lbvh> (for the BVH accelerators and every mesh; a benchmark measures both unless given)
+    //   --obj <file> (render an OBJ mesh on the ground instead of a built-in scene)
+    //   --scene <name>  --benchmark (render every scene, or just --scene, at 1..--threads threads and print JSON)
+    //   --bench-vec3 (run the vec3 microbenchmarks and exit)
+    //   --bench-dispatch (time virtual calls against the RT_DEVIRTUALIZE switch for hits and scatters, and exit)
+    //   --bench-hit (time sphere hits with a raw vs. shared_ptr material in hit_record on 1..--threads threads, and exit)
+    //   --bench-refit <frames> (move the spheres of --scene each frame, refitting the --accel BVH, and exit)
+    //   --heatmap <file>  --heatmap-tests (per-pixel cost image: time, or intersection tests with RT_STATS 1)
+    //   --trace <file.json> (timeline for chrome://tracing or ui.perfetto.dev)
+    //   --output <file>  --compare <reference.pfm>  --width <px>  --spp <n>  --depth <n>  --threads <n>  --tile <px>  --seed <n>
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--benchmark")
+            continue;
+        else if (arg == "--headless")
+            cam.headless = true;
+        else if (arg == "--bench-vec3")
+        {
+            vec3_bench().run(std::clog);
+            return 0;
+        }
+        else if (arg == "--bench-dispatch")
+        {
+            dispatch_bench().run(std::clog);
+            return 0;
+        }
+        else if (arg == "--bench-hit")
+            hit_benchmark = true;
+        else if (arg == "--bench-refit" && has_value)
+            refit_frames = std::atoi(argv[++i]);
+        else if (arg == "--progressive")
+            cam.progressive = true;
+        else if (arg == "--packets")
+            cam.packet_tracing = true;
+        else if (arg == "--wavefront")
+            cam.wavefront = true;
+        else if (arg == "--adaptive" && has_value)
+        {
+            cam.adaptive_sampling = true;
+            cam.adaptive_threshold = std::atof(argv[++i]);
+        }
+        else if (arg == "--min-spp" && has_value)
+            cam.min_samples_per_pixel = std::atoi(argv[++i]);
+        else if (arg == "--scene" && has_value)
+        {
+            scene = argv[++i];
+            bench_options.scenes.assign(1, scene);
+        }
+        else if (arg == "--obj" && has_value)
+            obj_file = argv[++i];
+        else if (arg == "--accel" && has_value)
+            accel = argv[++i];
+        else if (arg == "--build" && has_value)
+        {
+            if (!parse_bvh_build(argv[++i], build))
+            {
+                std::cerr << "Unknown BVH build: " << argv[i] << '\n';
+                return 1;
             }
+            bench_options.builds.assign(1, build);
+        }
+        else if ((arg == "--output" || arg == "-o") && has_value)
+            cam.output_file = argv[++i];
+        else if (arg == "--compare" && has_value)
+            cam.compare_file = argv[++i];
+        else if (arg == "--heatmap" && has_value)
+            cam.heatmap_file = argv[++i];
+        else if (arg == "--heatmap-tests")
+            cam.heatmap_tests = true;
+        else if (arg == "--trace" && has_value)
+            trace_file = argv[++i];
+        else if (arg == "--width" && has_value)
+            cam.image_width = std::atoi(argv[++i]);
+        else if (arg == "--spp" && has_value)
+            cam.samples_per_pixel = std::atoi(argv[++i]);
+        else if (arg == "--depth" && has_value)
+            cam.max_depth = std::atoi(argv[++i]);
+        else if (arg == "--threads" && has_value)
+            cam.num_threads = std::atoi(argv[++i]);
+        else if (arg == "--tile" && has_value)
+            cam.tile_size = std::atoi(argv[++i]);
+        else if (arg == "--seed" && has_value)
+            cam.seed = std::strtoull(argv[++i], nullptr, 10);
+        else
+        {
+            std::cerr << "Unknown or incomplete argument: " << arg << '\n';
+            return 1;
         }
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    if (hit_benchmark)
+    {
+        hit_bench bench;
+        bench.max_threads = cam.num_threads;
+        bench.run(std::clog);
+        return 0;
+    }
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    if (refit_frames > 0)
+    {
+        refit_bench bench;
+        bench.frames = refit_frames;
+        bench.threads = cam.num_threads;
+        bench.strategy = build;
+        return bench.run(scene, accel, std::clog) ? 0 : 1;
+    }
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    if (benchmark)
+    {
+        bench_options.accel = accel;
+        bench_options.image_width = cam.image_width;
+        bench_options.samples_per_pixel = cam.samples_per_pixel;
+        bench_options.max_depth = cam.max_depth;
+        bench_options.max_threads = cam.num_threads;
+        bench_options.packet_tracing = cam.packet_tracing;
+        bench_options.wavefront = cam.wavefront;
+
+        if (cam.output_file.empty())
+            return run_benchmarks(bench_options, std::cout) ? 0 : 1;
+
+        std::ofstream out(cam.output_file);
+        return out && run_benchmarks(bench_options, out) ? 0 : 1;
+    }
 
-    camera cam;
+    if (cam.headless && cam.output_file.empty())
+        cam.output_file = "render.png";
 
-    cam.aspect_ratio = 16.0 / 9.0;
-    cam.image_width = 1200;
-    cam.samples_per_pixel = 100;
-    cam.max_depth = 50;
+    if (!trace_file.empty())
+    {
+        render_trace().enable();
+        render_trace().name_thread("main");
+    }
 
-    cam.vfov = 20;
-    cam.lookfrom = point3(13, 2, 3);
-    cam.lookat = point3(0, 0, 0);
-    cam.vup = vec3(0, 1, 0);
+    hittable_list world;
+    {
+        trace_scope span("setup", "build scene");
+        if (!obj_file.empty())
+        {
+            if (!obj_scene(obj_file, world, cam))
+                return 1;
+        }
+        else if (!build_scene(scene, world, cam))
+        {
+            std::cerr << "Unknown scene: " << scene << '\n';
+            return 1;
+        }
+    }
 
-    cam.defocus_angle = 0.6;
-    cam.focus_dist = 10.0;
+    bool uses_build = uses_bvh_build(accel, world);
+    auto build_start = std::chrono::steady_clock::now();
 
-    cam.fastRender = true;
+    {
+        trace_scope span("setup", "build acceleration");
+        if (!build_acceleration(accel, world, true, cam.num_threads, build))
+        {
+            std::cerr << "Unknown accelerator: " << accel << '\n';
+            return 1;
+        }
+    }
 
-    cam.render(world);
+    std::chrono::duration<double> build_time = std::chrono::steady_clock::now() - build_start;
+    int build_threads = cam.num_threads > 0 ? cam.num_threads : static_cast<int>(std::thread::hardware_concurrency());
+    std::clog << "Acceleration structure (" << accel;
+    if (uses_build)
+        std::clog << ", " << bvh_build_name(build);
+    std::clog << ") built in " << build_time.count() << "s on "
+              << std::max(build_threads, 1) << " threads\n";
+
+    // A failed write or comparison is reported in the exit code, for batch jobs.
+    bool ok = cam.render(world);
+
+    if (!trace_file.empty())
+    {
+        if (render_trace().write(trace_file))
+            std::clog << "Wrote " << trace_file << '\n';
+        else
+        {
+            std::cerr << "Failed to write " << trace_file << '\n';
+            ok = false;
+        }
+    }
+    return ok ? 0 : 1;
 }
-
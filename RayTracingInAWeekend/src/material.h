@@ -5,6 +5,17 @@
 
 class hit_record;
 
+// The concrete type behind a material pointer. It is stored in the base class, so batched
+// shading and the switch in dispatch.h can call each scatter() directly instead of through the
+// vtable.
+enum class material_kind
+{
+	lambertian,
+	metal,
+	dielectric,
+	other
+};
+
 class material
 {
 public:
@@ -13,12 +24,23 @@ public:
 	virtual bool scatter(
 		const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
 	) const = 0;
+
+	material_kind kind() const { return tag; }
+
+protected:
+	material(material_kind k = material_kind::other) : tag(k)
+	{
+
+	}
+
+private:
+	material_kind tag;
 };
 
-class lambertian : public material
+class lambertian final : public material
 {
 public:
-	lambertian(const color& a) : albedo(a)
+	lambertian(const color& a) : material(material_kind::lambertian), albedo(a)
 	{
 
 	}
@@ -30,7 +52,7 @@ public:
 		if (scatter_direction.near_zero())
 			scatter_direction = rec.normal;
 
-		scattered = ray(rec.p, scatter_direction);
+		scattered = ray(rec.spawn_point(scatter_direction), scatter_direction);
 		attenuation = albedo;
 		return true;
 	}
@@ -39,10 +61,10 @@ private:
 	color albedo;
 };
 
-class metal : public material 
+class metal final : public material
 {
 public:
-	metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) 
+	metal(const color& a, real f) : material(material_kind::metal), albedo(a), fuzz(f < 1 ? f : 1) 
 	{
 	
 	}
@@ -50,30 +72,31 @@ public:
 	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
 		const override {
 		vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-		scattered = ray(rec.p, reflected + fuzz * random_unit_vector());
+		vec3 direction = reflected + fuzz * random_unit_vector();
+		scattered = ray(rec.spawn_point(direction), direction);
 		attenuation = albedo;
 		return (dot(scattered.direction(), rec.normal) > 0);
 	}
 
 private:
 	color albedo;
-	double fuzz;
+	real fuzz;
 };
 
-class dielectric : public material
+class dielectric final : public material
 {
 public:
-	dielectric(double index_of_refraction) : ir(index_of_refraction) {}
+	dielectric(real index_of_refraction) : material(material_kind::dielectric), ir(index_of_refraction) {}
 
 	bool scatter(const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered)
 		const override {
 		attenuation = color(1.0, 1.0, 1.0);
-		double refraction_ratio = rec.front_face ? (1.0 / ir) : ir;
+		real refraction_ratio = rec.front_face ? (1 / ir) : ir;
 
 		vec3 unit_direction = unit_vector(r_in.direction());
 
-		double cos_theta = fmin(dot(-unit_direction, rec.normal), 1.0);
-		double sin_theta = sqrt(1.0 - cos_theta * cos_theta);
+		real cos_theta = fmin(dot(-unit_direction, rec.normal), real(1));
+		real sin_theta = sqrt(1 - cos_theta * cos_theta);
 
 		bool cannot_refract = refraction_ratio * sin_theta > 1.0;
 		vec3 direction;
@@ -83,13 +106,13 @@ public:
 		else
 			direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-		scattered = ray(rec.p, direction);
+		scattered = ray(rec.spawn_point(direction), direction);
 
 		return true;
 	}
 
 private:
-	double ir; // Stands for Index of Refraction
+	real ir; // Stands for Index of Refraction
 
 	static double reflectance(double cosine, double ref_idx)
 	{
@@ -0,0 +1,168 @@
+#ifndef OBJ_LOADER_H
+#define OBJ_LOADER_H
+
+#include "common.h"
+
+#include "triangle_mesh.h"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Reads the geometry of a Wavefront OBJ file into one triangle_mesh: v, vt and vn lines and
+// faces of any size, split into fans. Materials, groups and everything else are skipped.
+//
+// OBJ indexes positions, UVs and normals separately while the mesh shares one index between
+// them, so every distinct position/UV/normal combination used by a face becomes one vertex.
+// Normals and UVs are kept only if every face corner has them.
+class obj_loader
+{
+public:
+    // Returns nullptr after writing the reason to errors if the file can't be read or has no faces.
+    shared_ptr<triangle_mesh> load(const std::string& path, shared_ptr<material> surface, std::ostream& errors)
+    {
+        std::ifstream in(path);
+        if (!in)
+        {
+            errors << "Can't open " << path << '\n';
+            return nullptr;
+        }
+
+        std::string line;
+        int line_number = 0;
+        while (std::getline(in, line))
+        {
+            line_number++;
+            std::istringstream fields(line);
+            std::string type;
+            fields >> type;
+
+            if (type == "v")
+                read_floats(fields, file_positions, 3);
+            else if (type == "vt")
+                read_floats(fields, file_uvs, 2);
+            else if (type == "vn")
+                read_floats(fields, file_normals, 3);
+            else if (type == "f" && !read_face(fields))
+            {
+                errors << path << ':' << line_number << ": bad face\n";
+                return nullptr;
+            }
+        }
+
+        if (indices.empty())
+        {
+            errors << path << " has no faces\n";
+            return nullptr;
+        }
+        if (!all_normals)
+            normals.clear();
+        if (!all_uvs)
+            uvs.clear();
+        return make_shared<triangle_mesh>(std::move(positions), std::move(indices), surface,
+                                          std::move(normals), std::move(uvs));
+    }
+
+private:
+    class corner
+    {
+    public:
+        long position = 0;  // Indices into the file's lists, 0-based, -1 when absent
+        long uv = -1;
+        long normal = -1;
+
+        bool operator==(const corner& c) const { return position == c.position && uv == c.uv && normal == c.normal; }
+    };
+
+    class corner_hash
+    {
+    public:
+        size_t operator()(const corner& c) const
+        {
+            return std::hash<long>()(c.position) ^ (std::hash<long>()(c.uv) * 31) ^ (std::hash<long>()(c.normal) * 961);
+        }
+    };
+
+    std::vector<float> file_positions, file_uvs, file_normals;
+    std::vector<float> positions, uvs, normals;
+    std::vector<std::uint32_t> indices;
+    std::unordered_map<corner, std::uint32_t, corner_hash> vertices;
+    bool all_normals = true;
+    bool all_uvs = true;
+
+    static void read_floats(std::istringstream& fields, std::vector<float>& out, int count)
+    {
+        for (int k = 0; k < count; k++)
+        {
+            float f = 0;
+            fields >> f;
+            out.push_back(f);
+        }
+    }
+
+    static bool resolve(const std::string& text, size_t list_size, long& index)
+    {
+        // OBJ indices count from 1, or back from the end of the list when negative.
+        if (text.empty())
+            return false;
+        long i = std::strtol(text.c_str(), nullptr, 10);
+        index = i < 0 ? static_cast<long>(list_size) + i : i - 1;
+        return index >= 0 && static_cast<size_t>(index) < list_size;
+    }
+
+    bool read_face(std::istringstream& fields)
+    {
+        std::vector<std::uint32_t> face;
+        std::string token;
+        while (fields >> token)
+        {
+            // v, v/vt, v//vn or v/vt/vn
+            corner c;
+            size_t slash = token.find('/');
+            if (!resolve(token.substr(0, slash), file_positions.size() / 3, c.position))
+                return false;
+            if (slash != std::string::npos)
+            {
+                size_t second = token.find('/', slash + 1);
+                std::string uv = token.substr(slash + 1, second == std::string::npos ? std::string::npos : second - slash - 1);
+                if (!uv.empty() && !resolve(uv, file_uvs.size() / 2, c.uv))
+                    return false;
+                if (second != std::string::npos && !resolve(token.substr(second + 1), file_normals.size() / 3, c.normal))
+                    return false;
+            }
+            face.push_back(vertex(c));
+        }
+        if (face.size() < 3)
+            return false;
+
+        for (size_t k = 1; k + 1 < face.size(); k++)
+            indices.insert(indices.end(), { face[0], face[k], face[k + 1] });
+        return true;
+    }
+
+    std::uint32_t vertex(const corner& c)
+    {
+        auto found = vertices.find(c);
+        if (found != vertices.end())
+            return found->second;
+
+        auto index = static_cast<std::uint32_t>(positions.size() / 3);
+        vertices.emplace(c, index);
+        positions.insert(positions.end(), &file_positions[3 * c.position], &file_positions[3 * c.position] + 3);
+        all_uvs &= c.uv >= 0;
+        all_normals &= c.normal >= 0;
+        if (all_uvs)
+            uvs.insert(uvs.end(), &file_uvs[2 * c.uv], &file_uvs[2 * c.uv] + 2);
+        if (all_normals)
+            normals.insert(normals.end(), &file_normals[3 * c.normal], &file_normals[3 * c.normal] + 3);
+        return index;
+    }
+};
+
+#endif // !OBJ_LOADER_H
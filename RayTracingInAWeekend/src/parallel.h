@@ -0,0 +1,35 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+// Fork-join loops for the acceleration structure builds. Threads are started per call, which
+// costs tens of microseconds, so work is only split into chunks of at least `grain` items.
+
+inline int parallel_chunk_count(int count, int threads, int grain)
+{
+    return std::max(1, std::min(threads, count / grain));
+}
+
+template <typename Func>
+void parallel_chunks(int count, int threads, int grain, Func&& f)
+{
+    // Calls f(begin, end, chunk) for parallel_chunk_count() contiguous pieces of [0, count) at
+    // once, the first on the calling thread. The pieces depend only on the arguments, so two
+    // calls with the same arguments split the range the same way.
+    int chunks = parallel_chunk_count(count, threads, grain);
+    auto bound = [count, chunks](int c) {
+        return static_cast<int>(static_cast<long long>(count) * c / chunks);
+    };
+
+    std::vector<std::thread> workers;
+    for (int c = 1; c < chunks; c++)
+        workers.emplace_back([&f, &bound, c]() { f(bound(c), bound(c + 1), c); });
+    f(0, bound(1), 0);
+    for (auto& worker : workers)
+        worker.join();
+}
+
+#endif // !PARALLEL_H
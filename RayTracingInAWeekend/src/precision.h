@@ -0,0 +1,23 @@
+#ifndef PRECISION_H
+#define PRECISION_H
+
+// Scalar type of the geometry and color math: vec3, ray, interval, aabb and hit records.
+// RT_SINGLE_PRECISION 1 builds the renderer in float, which halves the size of every ray, hit
+// record and primitive; 0 (the default) keeps double. Define it on the compiler command line
+// (e.g. /DRT_SINGLE_PRECISION=1) and compare the result with --compare.
+#ifndef RT_SINGLE_PRECISION
+#define RT_SINGLE_PRECISION 0
+#endif
+
+#if RT_SINGLE_PRECISION
+using real = float;
+#else
+using real = double;
+#endif
+
+inline const char* precision_name()
+{
+    return sizeof(real) == sizeof(float) ? "float" : "double";
+}
+
+#endif // !PRECISION_H
@@ -0,0 +1,69 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include "parallel.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Stable LSD radix sort of 64-bit keys, each carrying an int, 8 bits per pass. A pass counts
+// the digits of each chunk in parallel, turns the counts into per-chunk output offsets, then
+// scatters the chunks in parallel. Passes where every key has the same digit are skipped, so
+// keys that only use their low bits cost only the passes they need.
+inline void radix_sort(std::vector<std::uint64_t>& keys, std::vector<int>& values, int threads)
+{
+    const int grain = 16384;
+    const int radix = 256;
+
+    int n = static_cast<int>(keys.size());
+    int chunks = parallel_chunk_count(n, threads, grain);
+
+    std::vector<std::uint64_t> sorted_keys(keys.size());
+    std::vector<int> sorted_values(values.size());
+    std::vector<int> offsets(static_cast<std::size_t>(chunks) * radix);
+
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        std::fill(offsets.begin(), offsets.end(), 0);
+        parallel_chunks(n, threads, grain, [&](int start, int end, int chunk) {
+            int* counts = &offsets[static_cast<std::size_t>(chunk) * radix];
+            for (int i = start; i < end; i++)
+                counts[(keys[i] >> shift) & (radix - 1)]++;
+            });
+
+        // Digit-major, chunk-minor prefix sum: chunk c's keys with digit d go after every
+        // smaller digit and after the earlier chunks' keys with digit d, which keeps it stable.
+        bool single_digit = false;
+        int sum = 0;
+        for (int d = 0; d < radix; d++)
+        {
+            int digit_start = sum;
+            for (int c = 0; c < chunks; c++)
+            {
+                int count = offsets[static_cast<std::size_t>(c) * radix + d];
+                offsets[static_cast<std::size_t>(c) * radix + d] = sum;
+                sum += count;
+            }
+            if (sum - digit_start == n)
+                single_digit = true;
+        }
+        if (single_digit)
+            continue;
+
+        parallel_chunks(n, threads, grain, [&](int start, int end, int chunk) {
+            int* next = &offsets[static_cast<std::size_t>(chunk) * radix];
+            for (int i = start; i < end; i++)
+            {
+                int slot = next[(keys[i] >> shift) & (radix - 1)]++;
+                sorted_keys[slot] = keys[i];
+                sorted_values[slot] = values[i];
+            }
+            });
+
+        keys.swap(sorted_keys);
+        values.swap(sorted_values);
+    }
+}
+
+#endif // !RADIX_SORT_H
@@ -0,0 +1,189 @@
+#ifndef RAY_PACKET_H
+#define RAY_PACKET_H
+
+#include "aabb.h"
+#include "cpu_features.h"
+#include "ray.h"
+
+// Up to max_size rays traced together. Each component is stored in its own array, so a box
+// test covers the whole packet with one AVX-512 or two AVX2 operations per step, and the sphere
+// test is a fixed-length loop the compiler can vectorize. Lane k is described by bit k of the
+// `active` masks passed around with a packet.
+class ray_packet
+{
+public:
+    static const int max_size = 8;
+
+    int size = 0;
+
+    ray_packet()
+    {
+        // Lanes past `size` are still read by the fixed-length loops below, so they must hold
+        // numbers; their results are masked off.
+        for (int k = 0; k < max_size; k++)
+        {
+            org_x[k] = org_y[k] = org_z[k] = 0;
+            dir_x[k] = dir_y[k] = dir_z[k] = 1;
+            inv_x[k] = inv_y[k] = inv_z[k] = 1;
+            t_max[k] = 0;
+        }
+    }
+
+    double org_x[max_size], org_y[max_size], org_z[max_size];
+    double dir_x[max_size], dir_y[max_size], dir_z[max_size];
+    double inv_x[max_size], inv_y[max_size], inv_z[max_size];
+    double t_max[max_size];     // Closest hit so far, shrinks as the packet is traced
+
+    void clear() { size = 0; }
+
+    void add(const ray& r, double t_limit = infinity)
+    {
+        int k = size++;
+        point3 o = r.origin();
+        vec3 d = r.direction();
+        org_x[k] = o.x(); org_y[k] = o.y(); org_z[k] = o.z();
+        dir_x[k] = d.x(); dir_y[k] = d.y(); dir_z[k] = d.z();
+        inv_x[k] = 1 / d.x(); inv_y[k] = 1 / d.y(); inv_z[k] = 1 / d.z();
+        t_max[k] = t_limit;
+    }
+
+    ray get(int k) const
+    {
+        return ray(point3(real(org_x[k]), real(org_y[k]), real(org_z[k])), vec3(real(dir_x[k]), real(dir_y[k]), real(dir_z[k])));
+    }
+
+    vec3 inv_dir(int k) const { return vec3(real(inv_x[k]), real(inv_y[k]), real(inv_z[k])); }
+
+    int full_mask() const { return (1 << size) - 1; }
+
+    static int lane_count(int mask)
+    {
+        int n = 0;
+        for (; mask != 0; mask &= mask - 1)
+            n++;
+        return n;
+    }
+
+    bool coherent(int active, double min_cos = 0.9) const
+    {
+        // True when every active ray's direction is within acos(min_cos) of the first one's.
+        // Such rays tend to visit the same nodes in the same order; diverging packets, like
+        // diffuse bounces, are better traced one ray at a time.
+        int first = -1;
+        for (int k = 0; k < size; k++)
+        {
+            if (!(active & (1 << k)))
+                continue;
+            if (first < 0)
+            {
+                first = k;
+                continue;
+            }
+            double d = dir_x[first] * dir_x[k] + dir_y[first] * dir_y[k] + dir_z[first] * dir_z[k];
+            double len2 = (dir_x[first] * dir_x[first] + dir_y[first] * dir_y[first] + dir_z[first] * dir_z[first])
+                        * (dir_x[k] * dir_x[k] + dir_y[k] * dir_y[k] + dir_z[k] * dir_z[k]);
+            if (d <= 0 || d * d < min_cos * min_cos * len2)
+                return false;
+        }
+        return true;
+    }
+
+    int hit_box(const aabb& box, double t_min, int active, double& t_near) const
+    {
+        // Returns the active rays that enter `box` before their closest hit. `t_near` is the
+        // smallest entry distance among them, used to order sibling nodes.
+        const double box_min[3] = { box.x.min, box.y.min, box.z.min };
+        const double box_max[3] = { box.x.max, box.y.max, box.z.max };
+        return hit_box(box_min, box_max, t_min, active, t_near);
+    }
+
+    int hit_box(const double* box_min, const double* box_max, double t_min, int active, double& t_near) const
+    {
+        double lo[max_size];
+        double hi[max_size];
+#if RT_X86
+        if (level == simd_level::avx512)
+            slabs_avx512(box_min, box_max, t_min, lo, hi);
+        else if (level == simd_level::avx2)
+            slabs_avx2(box_min, box_max, t_min, lo, hi);
+        else
+#endif
+            slabs_scalar(box_min, box_max, t_min, lo, hi);
+
+        int mask = 0;
+        t_near = infinity;
+        for (int k = 0; k < size; k++)
+        {
+            if ((active & (1 << k)) && lo[k] < hi[k])
+            {
+                mask |= 1 << k;
+                t_near = min_of(t_near, lo[k]);
+            }
+        }
+        return mask;
+    }
+
+private:
+    simd_level level = cpu_simd_level();
+
+    void slabs_scalar(const double* box_min, const double* box_max, double t_min, double* lo, double* hi) const
+    {
+        // Entry and exit distance of every lane; the ray enters the box when lo < hi.
+        for (int k = 0; k < max_size; k++)
+        {
+            double x0 = (box_min[0] - org_x[k]) * inv_x[k], x1 = (box_max[0] - org_x[k]) * inv_x[k];
+            double y0 = (box_min[1] - org_y[k]) * inv_y[k], y1 = (box_max[1] - org_y[k]) * inv_y[k];
+            double z0 = (box_min[2] - org_z[k]) * inv_z[k], z1 = (box_max[2] - org_z[k]) * inv_z[k];
+            lo[k] = max_of(max_of(min_of(x0, x1), min_of(y0, y1)), max_of(min_of(z0, z1), t_min));
+            hi[k] = min_of(min_of(max_of(x0, x1), max_of(y0, y1)), min_of(max_of(z0, z1), t_max[k]));
+        }
+    }
+
+#if RT_X86
+    RT_TARGET("avx2")
+    void slabs_avx2(const double* box_min, const double* box_max, double t_min, double* lo, double* hi) const
+    {
+        for (int k = 0; k < max_size; k += 4)
+        {
+            __m256d x0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box_min[0]), _mm256_loadu_pd(org_x + k)), _mm256_loadu_pd(inv_x + k));
+            __m256d x1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box_max[0]), _mm256_loadu_pd(org_x + k)), _mm256_loadu_pd(inv_x + k));
+            __m256d y0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box_min[1]), _mm256_loadu_pd(org_y + k)), _mm256_loadu_pd(inv_y + k));
+            __m256d y1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box_max[1]), _mm256_loadu_pd(org_y + k)), _mm256_loadu_pd(inv_y + k));
+            __m256d z0 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box_min[2]), _mm256_loadu_pd(org_z + k)), _mm256_loadu_pd(inv_z + k));
+            __m256d z1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(box_max[2]), _mm256_loadu_pd(org_z + k)), _mm256_loadu_pd(inv_z + k));
+
+            __m256d near_t = _mm256_max_pd(_mm256_max_pd(_mm256_min_pd(x0, x1), _mm256_min_pd(y0, y1)),
+                                           _mm256_max_pd(_mm256_min_pd(z0, z1), _mm256_set1_pd(t_min)));
+            __m256d far_t = _mm256_min_pd(_mm256_min_pd(_mm256_max_pd(x0, x1), _mm256_max_pd(y0, y1)),
+                                          _mm256_min_pd(_mm256_max_pd(z0, z1), _mm256_loadu_pd(t_max + k)));
+            _mm256_storeu_pd(lo + k, near_t);
+            _mm256_storeu_pd(hi + k, far_t);
+        }
+    }
+
+    RT_TARGET("avx512f")
+    void slabs_avx512(const double* box_min, const double* box_max, double t_min, double* lo, double* hi) const
+    {
+        __m512d x0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(box_min[0]), _mm512_loadu_pd(org_x)), _mm512_loadu_pd(inv_x));
+        __m512d x1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(box_max[0]), _mm512_loadu_pd(org_x)), _mm512_loadu_pd(inv_x));
+        __m512d y0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(box_min[1]), _mm512_loadu_pd(org_y)), _mm512_loadu_pd(inv_y));
+        __m512d y1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(box_max[1]), _mm512_loadu_pd(org_y)), _mm512_loadu_pd(inv_y));
+        __m512d z0 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(box_min[2]), _mm512_loadu_pd(org_z)), _mm512_loadu_pd(inv_z));
+        __m512d z1 = _mm512_mul_pd(_mm512_sub_pd(_mm512_set1_pd(box_max[2]), _mm512_loadu_pd(org_z)), _mm512_loadu_pd(inv_z));
+
+        __m512d near_t = _mm512_max_pd(_mm512_max_pd(_mm512_min_pd(x0, x1), _mm512_min_pd(y0, y1)),
+                                       _mm512_max_pd(_mm512_min_pd(z0, z1), _mm512_set1_pd(t_min)));
+        __m512d far_t = _mm512_min_pd(_mm512_min_pd(_mm512_max_pd(x0, x1), _mm512_max_pd(y0, y1)),
+                                      _mm512_min_pd(_mm512_max_pd(z0, z1), _mm512_loadu_pd(t_max)));
+        _mm512_storeu_pd(lo, near_t);
+        _mm512_storeu_pd(hi, far_t);
+    }
+#endif
+
+    // Plain compares map to single min/max instructions; fmin and fmax also handle NaN and are
+    // usually library calls.
+    static double min_of(double a, double b) { return a < b ? a : b; }
+    static double max_of(double a, double b) { return a > b ? a : b; }
+};
+
+#endif // !RAY_PACKET_H
@@ -0,0 +1,115 @@
+#ifndef REFIT_BENCH_H
+#define REFIT_BENCH_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "bvh_wide.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "scenes.h"
+#include "sphere.h"
+
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Moving objects without rebuilding: builds a BVH over a scene's spheres, then moves each a step
+// along its own random direction per frame and calls update(), which refits and rebuilds once
+// the SAH cost has grown too much. Reports each frame's update time and cost growth against the
+// time of a full build.
+//
+// The ground sphere and any other static geometry stay out of the tree, as they would in a
+// scene split into static and moving parts: the ground's box is so much larger than the rest
+// that it would dominate the SAH cost and hide how the other boxes loosen.
+class refit_bench
+{
+public:
+    int frames = 30;
+    double step = 0.05;             // Distance each sphere moves per frame
+    double max_cost_growth = 1.5;   // Passed to update()
+    int threads = 0;                // Build threads, 0 uses std::thread::hardware_concurrency()
+    bvh_build strategy = bvh_build::sah;
+
+    bool run(const std::string& scene, const std::string& accel, std::ostream& log)
+    {
+        hittable_list world;
+        camera cam;
+        if (!build_scene(scene, world, cam))
+        {
+            std::cerr << "Unknown scene: " << scene << '\n';
+            return false;
+        }
+
+        moving.clear();
+        velocity.clear();
+        hittable_list dynamic;
+        for (const auto& object : world.objects)
+        {
+            auto s = std::dynamic_pointer_cast<sphere>(object);
+            if (s && s->get_radius() < 100)
+            {
+                moving.push_back(s);
+                velocity.push_back(real(step) * random_unit_vector());
+                dynamic.add(s);
+            }
+        }
+        log << scene << ": " << moving.size() << " of " << world.objects.size() << " objects move\n";
+        if (moving.empty())
+            return true;
+
+        if (accel == "bvh")
+            animate<bvh>(dynamic, log);
+        else if (accel == "bvh4")
+            animate<wide_bvh<4>>(dynamic, log);
+        else if (accel == "bvh8")
+            animate<wide_bvh<8>>(dynamic, log);
+        else
+        {
+            std::cerr << "Refitting needs bvh, bvh4 or bvh8, not " << accel << '\n';
+            return false;
+        }
+        return true;
+    }
+
+private:
+    std::vector<shared_ptr<sphere>> moving;
+    std::vector<vec3> velocity;
+
+    template <typename Accel>
+    void animate(const hittable_list& dynamic, std::ostream& log)
+    {
+        auto start = std::chrono::steady_clock::now();
+        Accel tree(dynamic, threads, strategy);
+        double build_ms = milliseconds_since(start);
+        log << bvh_build_name(strategy) << " build: " << build_ms << " ms, SAH cost " << tree.sah_cost() << '\n';
+
+        double update_ms = 0;
+        int rebuilds = 0;
+        for (int frame = 1; frame <= frames; ++frame)
+        {
+            for (size_t k = 0; k < moving.size(); ++k)
+                moving[k]->move_to(moving[k]->get_center() + velocity[k]);
+
+            start = std::chrono::steady_clock::now();
+            bool rebuilt = tree.update(max_cost_growth);
+            double ms = milliseconds_since(start);
+            update_ms += ms;
+            rebuilds += rebuilt;
+
+            log << "frame " << frame << ": " << (rebuilt ? "rebuilt" : "refit") << " in " << ms
+                << " ms, SAH cost " << tree.cost_growth() << "x the last build's\n";
+        }
+
+        log << frames << " frames: " << update_ms / frames << " ms per update with " << rebuilds
+            << " rebuilds, against " << build_ms << " ms for a full build\n";
+    }
+
+    static double milliseconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+};
+
+#endif // !REFIT_BENCH_H
@@ -0,0 +1,125 @@
+#ifndef RENDER_STATS_H
+#define RENDER_STATS_H
+
+#include "material.h"
+
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+// Work counters for one render: rays per bounce, BVH node visits, primitive tests, scatter
+// calls per material kind and why paths ended. Each thread counts into its own thread-local
+// copy, and the camera adds them up per thread after each tile, so counting never touches
+// shared memory.
+//
+// RT_STATS 0 (the default) compiles every RT_COUNT away; 1 enables the counters. Define it on
+// the compiler command line (e.g. /DRT_STATS=1). The per-depth ray counts are always kept,
+// since the benchmark reports rays per second; that is one increment per ray.
+#ifndef RT_STATS
+#define RT_STATS 0
+#endif
+
+#if RT_STATS
+#define RT_COUNT(statement) statement
+#else
+#define RT_COUNT(statement) ((void)0)
+#endif
+
+class render_counters
+{
+public:
+    static const int depth_buckets = 64;    // Deeper bounces are counted in the last bucket
+    static const int material_kinds = static_cast<int>(material_kind::other) + 1;
+
+    std::uint64_t rays_at_depth[depth_buckets] = {};    // 0 = camera rays
+    std::uint64_t node_visits = 0;          // BVH nodes visited, by a single ray or a whole packet
+    std::uint64_t primitive_tests = 0;      // Ray-object intersection tests, per ray
+    std::uint64_t scatters[material_kinds] = {};    // By material_kind
+
+    std::uint64_t escaped = 0;              // Paths that left the scene
+    std::uint64_t absorbed = 0;             // Paths the material did not scatter
+    std::uint64_t roulette = 0;             // Paths ended by Russian roulette
+    std::uint64_t depth_limit = 0;          // Paths cut off at max_depth
+
+    void count_rays(int depth, std::uint64_t n = 1)
+    {
+        rays_at_depth[depth < depth_buckets ? depth : depth_buckets - 1] += n;
+    }
+
+    std::uint64_t rays() const
+    {
+        std::uint64_t total = 0;
+        for (std::uint64_t n : rays_at_depth)
+            total += n;
+        return total;
+    }
+
+    std::uint64_t paths() const { return escaped + absorbed + roulette + depth_limit; }
+
+    void add(const render_counters& other)
+    {
+        for (int d = 0; d < depth_buckets; ++d)
+            rays_at_depth[d] += other.rays_at_depth[d];
+        node_visits += other.node_visits;
+        primitive_tests += other.primitive_tests;
+        for (int k = 0; k < material_kinds; ++k)
+            scatters[k] += other.scatters[k];
+        escaped += other.escaped;
+        absorbed += other.absorbed;
+        roulette += other.roulette;
+        depth_limit += other.depth_limit;
+    }
+};
+
+inline render_counters& thread_counters()
+{
+    static thread_local render_counters counters;
+    return counters;
+}
+
+inline void print_render_counters(std::ostream& out, const std::vector<render_counters>& per_thread)
+{
+    render_counters total;
+    for (const render_counters& c : per_thread)
+        total.add(c);
+
+    double rays = static_cast<double>(total.rays());
+    double per_ray = rays > 0 ? 1 / rays : 0;
+
+    std::streamsize old_precision = out.precision(2);
+    out << std::fixed;
+    out << total.rays() << " rays, " << total.node_visits * per_ray << " node visits and "
+        << total.primitive_tests * per_ray << " primitive tests per ray\n";
+
+    out << "rays by depth:";
+    for (int d = 0; d < render_counters::depth_buckets; ++d)
+    {
+        if (total.rays_at_depth[d] != 0)
+            out << ' ' << d << ':' << total.rays_at_depth[d];
+    }
+    out << '\n';
+
+    static const char* const kind_names[render_counters::material_kinds] = { "lambertian", "metal", "dielectric", "other" };
+    out << "scatter calls:";
+    for (int k = 0; k < render_counters::material_kinds; ++k)
+        out << ' ' << kind_names[k] << ' ' << total.scatters[k];
+    out << '\n';
+
+    out << total.paths() << " paths: " << total.escaped << " escaped, " << total.absorbed << " absorbed, "
+        << total.roulette << " ended by roulette, " << total.depth_limit << " hit max_depth\n";
+
+    out << "thread        rays  node visits  prim tests\n";
+    for (std::size_t t = 0; t < per_thread.size(); ++t)
+    {
+        const render_counters& c = per_thread[t];
+        out << std::setw(6) << t
+            << std::setw(12) << c.rays()
+            << std::setw(13) << c.node_visits
+            << std::setw(12) << c.primitive_tests << '\n';
+    }
+    out.unsetf(std::ios_base::floatfield);
+    out.precision(old_precision);
+}
+
+#endif // !RENDER_STATS_H
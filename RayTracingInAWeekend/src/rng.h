@@ -0,0 +1,69 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <cstdint>
+
+// PCG32 (O'Neill, pcg-random.org): 16 bytes of state, one multiply-add per draw.
+// Every render thread owns one, so sampling never touches shared state.
+class pcg32
+{
+public:
+    pcg32() = default;
+
+    pcg32(std::uint64_t initstate, std::uint64_t initseq) { seed(initstate, initseq); }
+
+    void seed(std::uint64_t initstate, std::uint64_t initseq)
+    {
+        // Different `initseq` values select independent streams.
+        state = 0;
+        inc = (initseq << 1u) | 1u;
+        next_uint();
+        state += initstate;
+        next_uint();
+    }
+
+    std::uint32_t next_uint()
+    {
+        std::uint64_t old = state;
+        state = old * 6364136223846793005ULL + inc;
+        auto xorshifted = static_cast<std::uint32_t>(((old >> 18u) ^ old) >> 27u);
+        auto rot = static_cast<std::uint32_t>(old >> 59u);
+        return (xorshifted >> rot) | (xorshifted << ((32u - rot) & 31u));
+    }
+
+    double next_double()
+    {
+        // Returns a random real in [0,1).
+        return next_uint() * (1.0 / 4294967296.0);
+    }
+
+private:
+    std::uint64_t state = 0x853c49e6748fea9bULL;
+    std::uint64_t inc = 0xda3e39cb94b95bdbULL;
+};
+
+inline std::uint64_t splitmix64(std::uint64_t x)
+{
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+inline pcg32& thread_rng()
+{
+    // Constant-initialized, so access is a plain TLS load with no init guard.
+    static thread_local pcg32 generator;
+    return generator;
+}
+
+inline void seed_pixel_sample(std::uint64_t render_seed, int i, int j, int sample)
+{
+    // Restart the calling thread's generator on a stream that depends only on the pixel and
+    // sample index, so an image is identical no matter which thread renders which pixel.
+    std::uint64_t pixel = (static_cast<std::uint64_t>(static_cast<std::uint32_t>(j)) << 32)
+                        | static_cast<std::uint32_t>(i);
+    thread_rng().seed(splitmix64(render_seed ^ splitmix64(pixel)), static_cast<std::uint64_t>(sample));
+}
+
+#endif // !RNG_H
@@ -0,0 +1,447 @@
+#ifndef SCENES_H
+#define SCENES_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "bvh_wide.h"
+#include "camera.h"
+#include "hittable_list.h"
+#include "instance.h"
+#include "material.h"
+#include "obj_loader.h"
+#include "sphere.h"
+#include "sphere_batch.h"
+#include "triangle.h"
+#include "triangle_mesh.h"
+
+#include <functional>
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+// The scenes main.cpp and the benchmark can render, each with its camera view. Every scene
+// restarts the calling thread's generator first, so it is built the same way on every run.
+
+inline void random_spheres_scene(hittable_list& world, camera& cam)
+{
+    // The final scene of Ray Tracing in One Weekend: ~480 small spheres around three large ones.
+    thread_rng() = pcg32();
+
+    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, ground_material));
+
+    for (int a = -11; a < 11; a++) {
+        for (int b = -11; b < 11; b++) {
+            auto choose_mat = random_double();
+            point3 center(a + 0.9 * random_double(), 0.2, b + 0.9 * random_double());
+
+            if ((center - point3(4, 0.2, 0)).length() > 0.9) {
+                shared_ptr<material> sphere_material;
+
+                if (choose_mat < 0.8) {
+                    // diffuse
+                    auto albedo = color::random() * color::random();
+                    sphere_material = make_shared<lambertian>(albedo);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else if (choose_mat < 0.95) {
+                    // metal
+                    auto albedo = color::random(0.5, 1);
+                    auto fuzz = random_double(0, 0.5);
+                    sphere_material = make_shared<metal>(albedo, fuzz);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+                else {
+                    // glass
+                    sphere_material = make_shared<dielectric>(1.5);
+                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                }
+            }
+        }
+    }
+
+    auto material1 = make_shared<dielectric>(1.5);
+    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    cam.vfov = 20;
+    cam.lookfrom = point3(13, 2, 3);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0.6;
+    cam.focus_dist = 10.0;
+}
+
+inline void dense_spheres_scene(hittable_list& world, camera& cam)
+{
+    // A 240x240 grid of small, jittered diffuse and metal spheres (57,600 in all), seen at a
+    // grazing angle so rays pass over many of them: stresses traversal rather than shading.
+    thread_rng() = pcg32();
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+
+    const int n = 240;
+    const double spacing = 0.25;
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            point3 center((a - n / 2 + 0.6 * random_double()) * spacing, 0.08,
+                          (b - n / 2 + 0.6 * random_double()) * spacing);
+            shared_ptr<material> sphere_material;
+            if (random_double() < 0.85)
+                sphere_material = make_shared<lambertian>(color::random() * color::random());
+            else
+                sphere_material = make_shared<metal>(color::random(0.5, 1), random_double(0, 0.3));
+            world.add(make_shared<sphere>(center, 0.08, sphere_material));
+        }
+    }
+
+    cam.vfov = 35;
+    cam.lookfrom = point3(0, 3, 18);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    cam.focus_dist = 10.0;
+}
+
+inline void glass_scene(hittable_list& world, camera& cam)
+{
+    // Mostly dielectric spheres: long refraction paths, where Russian roulette rarely ends a
+    // path early and the dielectric scatter dominates.
+    thread_rng() = pcg32();
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+
+    auto glass = make_shared<dielectric>(1.5);
+    for (int a = -8; a < 8; a++) {
+        for (int b = -8; b < 8; b++) {
+            point3 center(a + 0.8 * random_double(), 0.3, b + 0.8 * random_double());
+            if (random_double() < 0.8)
+                world.add(make_shared<sphere>(center, 0.3, glass));
+            else
+                world.add(make_shared<sphere>(center, 0.3, make_shared<lambertian>(color::random() * color::random())));
+        }
+    }
+
+    world.add(make_shared<sphere>(point3(0, 1.5, 0), 1.5, glass));
+    world.add(make_shared<sphere>(point3(-3.5, 1, 1), 1.0, make_shared<dielectric>(1.33)));
+    world.add(make_shared<sphere>(point3(3.5, 1, -1), 1.0, make_shared<dielectric>(2.4)));
+
+    cam.vfov = 30;
+    cam.lookfrom = point3(10, 4, 10);
+    cam.lookat = point3(0, 0.5, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    cam.focus_dist = 10.0;
+}
+
+inline point3 bumpy_ball_point(int ring, int segment, int rings, int segments, double center_y)
+{
+    // A point on a ball of radius 1.5 with bumps, centered on the y axis.
+    double theta = pi * ring / rings;
+    double phi = 2 * pi * segment / segments;
+    double r = 1.5 * (1 + 0.1 * std::sin(6 * theta) * std::sin(8 * phi));
+    return point3(real(r * std::sin(theta) * std::cos(phi)),
+                  real(center_y + r * std::cos(theta)),
+                  real(r * std::sin(theta) * std::sin(phi)));
+}
+
+inline void add_bumpy_ball(hittable_list& list, int rings, int segments, double center_y, shared_ptr<material> surface)
+{
+    // The bumpy ball as 2 * rings * segments separate triangles.
+    auto vertex = [&](int ring, int segment) { return bumpy_ball_point(ring, segment, rings, segments, center_y); };
+
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < segments; j++) {
+            point3 p00 = vertex(i, j), p01 = vertex(i, j + 1);
+            point3 p10 = vertex(i + 1, j), p11 = vertex(i + 1, j + 1);
+            list.add(make_shared<triangle>(p00, p10, p11, surface));
+            list.add(make_shared<triangle>(p00, p11, p01, surface));
+        }
+    }
+}
+
+inline shared_ptr<triangle_mesh> bumpy_ball_mesh(int rings, int segments, double center_y, shared_ptr<material> surface)
+{
+    // The bumpy ball as one indexed mesh with smooth normals: each vertex is stored once and the
+    // poles are single vertices, so the slivers at the poles drop out, leaving
+    // 2 * (rings - 1) * segments triangles.
+    std::vector<float> positions;
+    auto add_vertex = [&](int ring, int segment) {
+        point3 p = bumpy_ball_point(ring, segment, rings, segments, center_y);
+        positions.insert(positions.end(), { float(p.x()), float(p.y()), float(p.z()) });
+    };
+    add_vertex(0, 0);
+    add_vertex(rings, 0);
+    for (int i = 1; i < rings; i++)
+        for (int j = 0; j < segments; j++)
+            add_vertex(i, j);
+
+    auto index = [&](int ring, int segment) {
+        if (ring == 0)
+            return std::uint32_t(0);
+        if (ring == rings)
+            return std::uint32_t(1);
+        return std::uint32_t(2 + (ring - 1) * segments + segment % segments);
+    };
+
+    std::vector<std::uint32_t> indices;
+    indices.reserve(6 * static_cast<size_t>(rings - 1) * segments);
+    for (int i = 0; i < rings; i++) {
+        for (int j = 0; j < segments; j++) {
+            std::uint32_t i00 = index(i, j), i01 = index(i, j + 1);
+            std::uint32_t i10 = index(i + 1, j), i11 = index(i + 1, j + 1);
+            if (i10 != i11)
+                indices.insert(indices.end(), { i00, i10, i11 });
+            if (i00 != i01)
+                indices.insert(indices.end(), { i00, i11, i01 });
+        }
+    }
+
+    // Vertex normals from the area-weighted normals of the faces around each vertex.
+    std::vector<float> normals(positions.size(), 0.0f);
+    for (size_t k = 0; k < indices.size(); k += 3) {
+        const float* a = &positions[3 * indices[k]];
+        const float* b = &positions[3 * indices[k + 1]];
+        const float* c = &positions[3 * indices[k + 2]];
+        vec3 face = cross(vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+        for (int v = 0; v < 3; v++)
+            for (int axis = 0; axis < 3; axis++)
+                normals[3 * indices[k + v] + axis] += float(face[axis]);
+    }
+    for (size_t k = 0; k < normals.size(); k += 3) {
+        vec3 n = unit_vector(vec3(normals[k], normals[k + 1], normals[k + 2]));
+        for (int axis = 0; axis < 3; axis++)
+            normals[k + axis] = float(n[axis]);
+    }
+
+    return make_shared<triangle_mesh>(std::move(positions), std::move(indices), surface, std::move(normals));
+}
+
+inline void mesh_scene(hittable_list& world, camera& cam)
+{
+    // A bumpy ball tessellated into 147,456 triangles on a diffuse ground.
+    thread_rng() = pcg32();
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    add_bumpy_ball(world, 192, 384, 1.7, make_shared<metal>(color(0.8, 0.6, 0.4), 0.2));
+
+    cam.vfov = 30;
+    cam.lookfrom = point3(6, 4, 8);
+    cam.lookat = point3(0, 1.5, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    cam.focus_dist = 10.0;
+}
+
+inline void large_mesh_scene(hittable_list& world, camera& cam)
+{
+    // The mesh scene's ball as one indexed mesh of 4,190,208 triangles, about 180 MB with its
+    // BVH; separate triangle objects under a world BVH would take several times that.
+    thread_rng() = pcg32();
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    world.add(bumpy_ball_mesh(1024, 2048, 1.7, make_shared<metal>(color(0.8, 0.6, 0.4), 0.2)));
+
+    cam.vfov = 30;
+    cam.lookfrom = point3(6, 4, 8);
+    cam.lookat = point3(0, 1.5, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    cam.focus_dist = 10.0;
+}
+
+inline void instances_scene(hittable_list& world, camera& cam)
+{
+    // A 256x256 field of 65,536 instances of one figure, each turned, scaled and colored at
+    // random: a 9,024-triangle ball with a small sphere above it, 591 million triangles in all,
+    // stored once. The figure is a sub-scene with a BVH of its own over the ball's mesh, which
+    // has its own too, and the acceleration structure built over the world becomes the top level.
+    thread_rng() = pcg32();
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+
+    auto gray = make_shared<lambertian>(color(0.5, 0.5, 0.5));
+    hittable_list parts;
+    parts.add(bumpy_ball_mesh(48, 96, 0, gray));
+    parts.add(make_shared<sphere>(point3(0, 2.1, 0), 0.3, gray));
+    shared_ptr<hittable> figure = make_shared<bvh>(parts);
+
+    std::vector<shared_ptr<material>> palette;
+    for (int k = 0; k < 12; k++)
+        palette.push_back(make_shared<lambertian>(color::random() * color::random()));
+    for (int k = 0; k < 4; k++)
+        palette.push_back(make_shared<metal>(color::random(0.5, 1), random_double(0, 0.3)));
+
+    const int n = 256;
+    const double spacing = 1.2;
+    for (int a = 0; a < n; a++) {
+        for (int b = 0; b < n; b++) {
+            real scale = real(random_double(0.15, 0.35));
+            vec3 offset((a - n / 2 + 0.5 * random_double()) * spacing, 1.5 * scale,
+                        (b - n / 2 + 0.5 * random_double()) * spacing);
+            affine_transform to_world = affine_transform::translation(offset)
+                * affine_transform::rotation(random_unit_vector(), random_double(0, 360))
+                * affine_transform::scaling(scale);
+            auto mat = palette[static_cast<size_t>(random_double() * palette.size())];
+            world.add(make_shared<instance>(figure, to_world, mat));
+        }
+    }
+
+    cam.vfov = 30;
+    cam.lookfrom = point3(0, 6, 24);
+    cam.lookat = point3(0, 0, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    cam.focus_dist = 10.0;
+}
+
+inline bool obj_scene(const std::string& path, hittable_list& world, camera& cam)
+{
+    // A mesh from an OBJ file on the ground, scaled to 3 units across and seen as the mesh scene.
+    thread_rng() = pcg32();
+
+    shared_ptr<triangle_mesh> mesh = obj_loader().load(path, make_shared<metal>(color(0.8, 0.6, 0.4), 0.2), std::cerr);
+    if (!mesh)
+        return false;
+
+    aabb box = mesh->bounding_box();
+    real scale = real(3.0 / std::max(box.x.size(), std::max(box.y.size(), box.z.size())));
+    vec3 offset(-scale * 0.5 * (box.x.min + box.x.max), -scale * box.y.min, -scale * 0.5 * (box.z.min + box.z.max));
+
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+    world.add(make_shared<instance>(mesh, affine_transform::translation(offset) * affine_transform::scaling(scale)));
+
+    cam.vfov = 30;
+    cam.lookfrom = point3(6, 4, 8);
+    cam.lookat = point3(0, 1.5, 0);
+    cam.vup = vec3(0, 1, 0);
+
+    cam.defocus_angle = 0;
+    cam.focus_dist = 10.0;
+    return true;
+}
+
+inline const std::vector<std::string>& scene_names()
+{
+    static const std::vector<std::string> names = { "random_spheres", "dense_spheres", "glass", "mesh", "large_mesh", "instances" };
+    return names;
+}
+
+inline bool build_scene(const std::string& name, hittable_list& world, camera& cam)
+{
+    if (name == "random_spheres")
+        random_spheres_scene(world, cam);
+    else if (name == "dense_spheres")
+        dense_spheres_scene(world, cam);
+    else if (name == "glass")
+        glass_scene(world, cam);
+    else if (name == "mesh")
+        mesh_scene(world, cam);
+    else if (name == "large_mesh")
+        large_mesh_scene(world, cam);
+    else if (name == "instances")
+        instances_scene(world, cam);
+    else
+        return false;
+    return true;
+}
+
+inline std::vector<triangle_mesh*> scene_meshes(const hittable_list& world)
+{
+    // The meshes anywhere in the world: among its objects or inside their instances, sub-scene
+    // BVHs and lists, each once. An aggregate shared by many instances is searched once.
+    std::vector<triangle_mesh*> meshes;
+    std::unordered_set<const hittable*> seen;
+    std::function<void(hittable&)> search = [&](hittable& h) {
+        if (h.kind() != hittable_kind::aggregate || !seen.insert(&h).second)
+            return;
+        if (auto mesh = dynamic_cast<triangle_mesh*>(&h))
+            meshes.push_back(mesh);
+        else
+            h.visit_children(search);
+    };
+    world.visit_children(search);
+    return meshes;
+}
+
+inline bool uses_bvh_build(const std::string& accel, const hittable_list& world)
+{
+    // Whether building `world` with `accel` depends on the BVH build strategy: a BVH accelerator,
+    // or meshes, which always have BVHs of their own.
+    return accel == "bvh" || accel == "bvh4" || accel == "bvh8" || !scene_meshes(world).empty();
+}
+
+inline bool build_acceleration(const std::string& accel, hittable_list& world, bool verbose = true, int threads = 0,
+                               bvh_build strategy = bvh_build::sah)
+{
+    // Replaces `world` with the named acceleration structure over its objects: linear (test
+    // every object), bvh (binary), bvh4 or bvh8 (wide BVH with SIMD child tests), or batch
+    // (every sphere in one SIMD sphere_batch). BVHs are built with `threads` threads, 0 uses
+    // std::thread::hardware_concurrency(), by the given strategy, and so are the BVHs of the
+    // scene's meshes whatever the accelerator, so their cost is part of the build.
+    std::vector<triangle_mesh*> meshes = scene_meshes(world);
+    if (accel == "batch")
+    {
+        auto batch = make_shared<sphere_batch>();
+        hittable_list others;
+        for (const auto& object : world.objects)
+        {
+            if (auto s = std::dynamic_pointer_cast<sphere>(object))
+                batch->add(s->get_center(), s->get_radius(), s->get_material());
+            else
+                others.add(object);
+        }
+        others.add(batch);
+        world = others;
+        if (verbose)
+        {
+            std::clog << "Sphere batch of " << batch->size() << " using the "
+                      << simd_level_name(batch->active_simd_level()) << " kernel\n";
+        }
+    }
+    else if (accel == "bvh")
+    {
+        world = hittable_list(make_shared<bvh>(world, threads, strategy));
+    }
+    else if (accel == "bvh4")
+    {
+        world = hittable_list(make_shared<wide_bvh<4>>(world, threads, strategy));
+    }
+    else if (accel == "bvh8")
+    {
+        world = hittable_list(make_shared<wide_bvh<8>>(world, threads, strategy));
+    }
+    else if (accel != "linear")
+    {
+        return false;
+    }
+
+    // The structures above only need the meshes' bounds, which are known before their BVHs.
+    std::size_t triangles = 0;
+    for (triangle_mesh* mesh : meshes)
+    {
+        mesh->build(threads, strategy);
+        triangles += mesh->triangle_count();
+    }
+    if (verbose && !meshes.empty())
+    {
+        std::clog << meshes.size() << (meshes.size() == 1 ? " mesh" : " meshes") << " of " << triangles
+                  << " triangles built (" << bvh_build_name(strategy) << ")\n";
+    }
+    return true;
+}
+
+#endif // !SCENES_H
@@ -4,11 +4,15 @@
 #include "hittable.h"
 #include "vec3.h"
 
-class sphere : public hittable
+class sphere final : public hittable
 {
 public:
-	sphere(point3 _center, double _radius, shared_ptr<material> _material)
-		: center(_center), radius(_radius), mat(_material) {}
+	sphere(point3 _center, real _radius, shared_ptr<material> _material)
+		: hittable(hittable_kind::sphere), center(_center), radius(_radius), mat(_material)
+	{
+		auto rvec = vec3(radius, radius, radius);
+		bbox = aabb(center - rvec, center + rvec);
+	}
 
 	bool hit(const ray& r, interval ray_t, hit_record& rec) const override
 	{
@@ -17,16 +21,26 @@ public:
 		auto half_b = dot(oc, r.direction());
 		auto c = oc.length_squared() - radius * radius;
 
-		auto discriminant = half_b * half_b - a * c;
+		// The discriminant half_b^2 - a*c is taken from the distance between the center and the
+		// ray's line instead, which does not cancel for large spheres or distant origins.
+		vec3 l = oc - (half_b / a) * r.direction();
+		auto discriminant = a * (radius * radius - l.length_squared());
 		if (discriminant < 0) 
 			return false;
 
-		auto sqrtd = sqrt(discriminant);
+		// Both roots without subtracting nearly equal numbers: q has the sign of -half_b.
+		auto q = -half_b - std::copysign(sqrt(discriminant), half_b);
+		if (q == 0)
+			return false;
+		auto near_root = q / a;
+		auto far_root = c / q;
+		if (far_root < near_root)
+			std::swap(near_root, far_root);
 
-		auto root = (-half_b - sqrtd) / a;
+		auto root = near_root;
 		if (!ray_t.surrounds(root)) 
 		{
-			root = (-half_b + sqrtd) / a;
+			root = far_root;
 			if (!ray_t.surrounds(root))
 				return false;
 		}
@@ -35,15 +49,85 @@ public:
 		rec.p = r.at(rec.t);
 		vec3 outward_normal = (rec.p - center) / radius;
 		rec.set_face_normal(r, outward_normal);
-		rec.mat = mat;
+		rec.mat = mat.get();
 
 		return true;
 	}
 
+	int hit_packet(ray_packet& packet, double t_min, int active, hit_record* recs) const override
+	{
+		// Same arithmetic as hit(), solved for every ray of the packet in one loop.
+		real roots[ray_packet::max_size];
+		for (int k = 0; k < ray_packet::max_size; k++)
+		{
+			real ocx = static_cast<real>(packet.org_x[k]) - center.x();
+			real ocy = static_cast<real>(packet.org_y[k]) - center.y();
+			real ocz = static_cast<real>(packet.org_z[k]) - center.z();
+			real dx = static_cast<real>(packet.dir_x[k]);
+			real dy = static_cast<real>(packet.dir_y[k]);
+			real dz = static_cast<real>(packet.dir_z[k]);
+
+			real a = dx * dx + dy * dy + dz * dz;
+			real half_b = ocx * dx + ocy * dy + ocz * dz;
+			real c = (ocx * ocx + ocy * ocy + ocz * ocz) - radius * radius;
+
+			real s = half_b / a;
+			real lx = ocx - s * dx, ly = ocy - s * dy, lz = ocz - s * dz;
+			real discriminant = a * (radius * radius - (lx * lx + ly * ly + lz * lz));
+
+			real q = -half_b - std::copysign(sqrt(discriminant < 0 ? real(0) : discriminant), half_b);
+			real r0 = q / a;
+			real r1 = c / q;
+			real near_root = r0 < r1 ? r0 : r1;
+			real far_root = r0 < r1 ? r1 : r0;
+
+			real lo = static_cast<real>(t_min);
+			real hi = static_cast<real>(packet.t_max[k]);
+			real root = (lo < near_root && near_root < hi) ? near_root : far_root;
+			bool valid = discriminant >= 0 && q != 0 && lo < root && root < hi;
+			roots[k] = valid ? root : static_cast<real>(infinity);
+		}
+
+		int mask = 0;
+		for (int k = 0; k < packet.size; k++)
+		{
+			if (!(active & (1 << k)) || roots[k] == static_cast<real>(infinity))
+				continue;
+
+			ray r = packet.get(k);
+			hit_record& rec = recs[k];
+			rec.t = roots[k];
+			rec.p = r.at(rec.t);
+			vec3 outward_normal = (rec.p - center) / radius;
+			rec.set_face_normal(r, outward_normal);
+			rec.mat = mat.get();
+
+			packet.t_max[k] = rec.t;
+			mask |= 1 << k;
+		}
+		return mask;
+	}
+
+	aabb bounding_box() const override { return bbox; }
+
+	const point3& get_center() const { return center; }
+
+	// Moves the sphere between frames. An acceleration structure over it needs a refit after.
+	void move_to(const point3& new_center)
+	{
+		center = new_center;
+		auto rvec = vec3(radius, radius, radius);
+		bbox = aabb(center - rvec, center + rvec);
+	}
+
+	real get_radius() const { return radius; }
+	const shared_ptr<material>& get_material() const { return mat; }
+
 private:
 	point3 center;
-	double radius;
+	real radius;
 	shared_ptr<material> mat;
+	aabb bbox;
 };
 
 #endif
\ No newline at end of file
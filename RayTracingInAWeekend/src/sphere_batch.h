@@ -0,0 +1,395 @@
+#ifndef SPHERE_BATCH_H
+#define SPHERE_BATCH_H
+
+#include "common.h"
+
+#include "cpu_features.h"
+#include "hittable.h"
+#include "render_stats.h"
+
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// Many spheres in one hittable, stored as separate arrays of center coordinates, radii and
+// material ids so a ray can be tested against several spheres per instruction. The kernel
+// (SSE2, AVX2 or AVX-512, 2/4/8 doubles per instruction) is picked from the running CPU.
+class sphere_batch : public hittable
+{
+public:
+    sphere_batch()
+        : hittable(hittable_kind::aggregate)
+    {
+        set_simd_level(cpu_simd_level());
+    }
+
+    void add(const point3& center, double radius, shared_ptr<material> mat)
+    {
+        cx.push_back(center.x());
+        cy.push_back(center.y());
+        cz.push_back(center.z());
+        radii.push_back(radius);
+        material_ids.push_back(material_id(mat));
+
+        auto rvec = vec3(real(radius), real(radius), real(radius));
+        bbox = aabb(bbox, aabb(center - rvec, center + rvec));
+    }
+
+    int size() const { return static_cast<int>(radii.size()); }
+
+    // Selects the kernel; requests above what the CPU supports fall back to the best it has.
+    void set_simd_level(simd_level requested)
+    {
+        level = static_cast<int>(requested) <= static_cast<int>(cpu_simd_level()) ? requested : cpu_simd_level();
+        switch (level)
+        {
+#if RT_X86
+        case simd_level::avx512: kernel = &closest_avx512; break;
+        case simd_level::avx2:   kernel = &closest_avx2; break;
+        case simd_level::sse2:   kernel = &closest_sse2; break;
+#endif
+        default:                 kernel = &closest_scalar; break;
+        }
+    }
+
+    simd_level active_simd_level() const { return level; }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (radii.empty())
+            return false;
+
+        // Every sphere is tested, whichever the kernel.
+        RT_COUNT(thread_counters().primitive_tests += radii.size());
+
+        query q;
+        point3 origin = r.origin();
+        vec3 dir = r.direction();
+        for (int k = 0; k < 3; k++)
+        {
+            q.origin[k] = origin[k];
+            q.dir[k] = dir[k];
+        }
+        q.a = dir.length_squared();
+        q.t_min = ray_t.min;
+
+        double closest = ray_t.max;
+        int index = kernel(*this, q, closest);
+        if (index < 0)
+            return false;
+
+        point3 center(real(cx[index]), real(cy[index]), real(cz[index]));
+        rec.t = real(closest);
+        rec.p = r.at(rec.t);
+        vec3 outward_normal = (rec.p - center) / real(radii[index]);
+        rec.set_face_normal(r, outward_normal);
+        rec.mat = materials[material_ids[index]].get();
+
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    class query
+    {
+    public:
+        double origin[3];
+        double dir[3];
+        double a;       // dir.length_squared()
+        double t_min;
+    };
+
+    // Returns the index of the nearest sphere hit in (q.t_min, closest) and lowers `closest` to
+    // its distance, or returns -1 and leaves `closest` alone.
+    typedef int (*closest_fn)(const sphere_batch&, const query&, double& closest);
+
+    std::vector<double> cx, cy, cz, radii;
+    std::vector<std::uint32_t> material_ids;
+    std::vector<shared_ptr<material>> materials;    // Owns every material the batch refers to
+    std::unordered_map<const material*, std::uint32_t> material_index;     // Into materials
+    aabb bbox;
+
+    simd_level level = simd_level::scalar;
+    closest_fn kernel = &closest_scalar;
+
+    std::uint32_t material_id(const shared_ptr<material>& mat)
+    {
+        // Hashed, since scenes with a material per sphere have as many materials as spheres.
+        auto found = material_index.emplace(mat.get(), static_cast<std::uint32_t>(materials.size()));
+        if (found.second)
+            materials.push_back(mat);
+        return found.first->second;
+    }
+
+    static int closest_range(const sphere_batch& b, const query& q, int begin, int end, double& closest)
+    {
+        // Same test as sphere::hit, used on its own and for the tail the vector kernels leave.
+        int best = -1;
+        for (int i = begin; i < end; i++)
+        {
+            double ocx = q.origin[0] - b.cx[i];
+            double ocy = q.origin[1] - b.cy[i];
+            double ocz = q.origin[2] - b.cz[i];
+            double half_b = ocx * q.dir[0] + ocy * q.dir[1] + ocz * q.dir[2];
+            double r2 = b.radii[i] * b.radii[i];
+            double c = ocx * ocx + ocy * ocy + ocz * ocz - r2;
+
+            double s = half_b / q.a;
+            double lx = ocx - s * q.dir[0], ly = ocy - s * q.dir[1], lz = ocz - s * q.dir[2];
+            double discriminant = q.a * (r2 - (lx * lx + ly * ly + lz * lz));
+            if (discriminant < 0)
+                continue;
+
+            double qr = -half_b - std::copysign(sqrt(discriminant), half_b);
+            if (qr == 0)
+                continue;
+            double near_root = qr / q.a;
+            double far_root = c / qr;
+            if (far_root < near_root)
+                std::swap(near_root, far_root);
+
+            double root = near_root;
+            if (!(q.t_min < root && root < closest))
+            {
+                root = far_root;
+                if (!(q.t_min < root && root < closest))
+                    continue;
+            }
+
+            closest = root;
+            best = i;
+        }
+        return best;
+    }
+
+    static int closest_scalar(const sphere_batch& b, const query& q, double& closest)
+    {
+        return closest_range(b, q, 0, b.size(), closest);
+    }
+
+    static int finish(const sphere_batch& b, const query& q, int vector_end,
+                      const double* lane_t, const double* lane_index, int lanes, double& closest)
+    {
+        // Picks the nearest lane result, then tests the spheres past the last full vector.
+        int best = -1;
+        for (int k = 0; k < lanes; k++)
+        {
+            if (lane_index[k] >= 0 && lane_t[k] < closest)
+            {
+                closest = lane_t[k];
+                best = static_cast<int>(lane_index[k]);
+            }
+        }
+
+        int tail = closest_range(b, q, vector_end, b.size(), closest);
+        return tail >= 0 ? tail : best;
+    }
+
+#if RT_X86
+    RT_TARGET("sse2")
+    static int closest_sse2(const sphere_batch& b, const query& q, double& closest)
+    {
+        const int lanes = 2;
+        int n = b.size() / lanes * lanes;
+
+        __m128d ox = _mm_set1_pd(q.origin[0]), oy = _mm_set1_pd(q.origin[1]), oz = _mm_set1_pd(q.origin[2]);
+        __m128d dx = _mm_set1_pd(q.dir[0]), dy = _mm_set1_pd(q.dir[1]), dz = _mm_set1_pd(q.dir[2]);
+        __m128d a = _mm_set1_pd(q.a);
+        __m128d t_min = _mm_set1_pd(q.t_min);
+        __m128d zero = _mm_setzero_pd();
+        __m128d sign_bit = _mm_set1_pd(-0.0);
+
+        __m128d best_t = _mm_set1_pd(closest);
+        __m128d best_index = _mm_set1_pd(-1);
+        __m128d index = _mm_set_pd(1, 0);
+        __m128d step = _mm_set1_pd(lanes);
+
+        for (int i = 0; i < n; i += lanes)
+        {
+            __m128d ocx = _mm_sub_pd(ox, _mm_loadu_pd(&b.cx[i]));
+            __m128d ocy = _mm_sub_pd(oy, _mm_loadu_pd(&b.cy[i]));
+            __m128d ocz = _mm_sub_pd(oz, _mm_loadu_pd(&b.cz[i]));
+            __m128d r = _mm_loadu_pd(&b.radii[i]);
+
+            __m128d half_b = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)), _mm_mul_pd(ocz, dz));
+            __m128d r2 = _mm_mul_pd(r, r);
+            __m128d c = _mm_sub_pd(_mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)), _mm_mul_pd(ocz, ocz)), r2);
+
+            // Discriminant from the center's distance to the ray's line, as in sphere::hit.
+            __m128d s = _mm_div_pd(half_b, a);
+            __m128d lx = _mm_sub_pd(ocx, _mm_mul_pd(s, dx));
+            __m128d ly = _mm_sub_pd(ocy, _mm_mul_pd(s, dy));
+            __m128d lz = _mm_sub_pd(ocz, _mm_mul_pd(s, dz));
+            __m128d l2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(lx, lx), _mm_mul_pd(ly, ly)), _mm_mul_pd(lz, lz));
+            __m128d disc = _mm_mul_pd(a, _mm_sub_pd(r2, l2));
+            __m128d has_roots = _mm_cmpge_pd(disc, zero);
+            if (_mm_movemask_pd(has_roots) == 0)
+            {
+                // Most rays miss most spheres; skip the square roots and divides.
+                index = _mm_add_pd(index, step);
+                continue;
+            }
+
+            // q = -half_b - copysign(sqrtd, half_b); the roots are q / a and c / q.
+            __m128d sqrtd = _mm_sqrt_pd(_mm_max_pd(disc, zero));
+            __m128d qr = _mm_sub_pd(_mm_sub_pd(zero, half_b), _mm_or_pd(sqrtd, _mm_and_pd(half_b, sign_bit)));
+            __m128d r0 = _mm_div_pd(qr, a);
+            __m128d r1 = _mm_div_pd(c, qr);
+            __m128d t0 = _mm_min_pd(r0, r1);
+            __m128d t1 = _mm_max_pd(r0, r1);
+
+            __m128d in0 = _mm_and_pd(_mm_cmpgt_pd(t0, t_min), _mm_cmplt_pd(t0, best_t));
+            __m128d in1 = _mm_and_pd(_mm_cmpgt_pd(t1, t_min), _mm_cmplt_pd(t1, best_t));
+            __m128d t = _mm_or_pd(_mm_and_pd(in0, t0), _mm_andnot_pd(in0, t1));
+            __m128d take = _mm_and_pd(_mm_and_pd(has_roots, _mm_cmpneq_pd(qr, zero)), _mm_or_pd(in0, in1));
+
+            best_t = _mm_or_pd(_mm_and_pd(take, t), _mm_andnot_pd(take, best_t));
+            best_index = _mm_or_pd(_mm_and_pd(take, index), _mm_andnot_pd(take, best_index));
+            index = _mm_add_pd(index, step);
+        }
+
+        double lane_t[lanes], lane_index[lanes];
+        _mm_storeu_pd(lane_t, best_t);
+        _mm_storeu_pd(lane_index, best_index);
+        return finish(b, q, n, lane_t, lane_index, lanes, closest);
+    }
+
+    RT_TARGET("avx2")
+    static int closest_avx2(const sphere_batch& b, const query& q, double& closest)
+    {
+        const int lanes = 4;
+        int n = b.size() / lanes * lanes;
+
+        __m256d ox = _mm256_set1_pd(q.origin[0]), oy = _mm256_set1_pd(q.origin[1]), oz = _mm256_set1_pd(q.origin[2]);
+        __m256d dx = _mm256_set1_pd(q.dir[0]), dy = _mm256_set1_pd(q.dir[1]), dz = _mm256_set1_pd(q.dir[2]);
+        __m256d a = _mm256_set1_pd(q.a);
+        __m256d t_min = _mm256_set1_pd(q.t_min);
+        __m256d zero = _mm256_setzero_pd();
+        __m256d sign_bit = _mm256_set1_pd(-0.0);
+
+        __m256d best_t = _mm256_set1_pd(closest);
+        __m256d best_index = _mm256_set1_pd(-1);
+        __m256d index = _mm256_set_pd(3, 2, 1, 0);
+        __m256d step = _mm256_set1_pd(lanes);
+
+        for (int i = 0; i < n; i += lanes)
+        {
+            __m256d ocx = _mm256_sub_pd(ox, _mm256_loadu_pd(&b.cx[i]));
+            __m256d ocy = _mm256_sub_pd(oy, _mm256_loadu_pd(&b.cy[i]));
+            __m256d ocz = _mm256_sub_pd(oz, _mm256_loadu_pd(&b.cz[i]));
+            __m256d r = _mm256_loadu_pd(&b.radii[i]);
+
+            __m256d half_b = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)), _mm256_mul_pd(ocz, dz));
+            __m256d r2 = _mm256_mul_pd(r, r);
+            __m256d c = _mm256_sub_pd(_mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)), _mm256_mul_pd(ocz, ocz)), r2);
+
+            __m256d s = _mm256_div_pd(half_b, a);
+            __m256d lx = _mm256_sub_pd(ocx, _mm256_mul_pd(s, dx));
+            __m256d ly = _mm256_sub_pd(ocy, _mm256_mul_pd(s, dy));
+            __m256d lz = _mm256_sub_pd(ocz, _mm256_mul_pd(s, dz));
+            __m256d l2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(lx, lx), _mm256_mul_pd(ly, ly)), _mm256_mul_pd(lz, lz));
+            __m256d disc = _mm256_mul_pd(a, _mm256_sub_pd(r2, l2));
+            __m256d has_roots = _mm256_cmp_pd(disc, zero, _CMP_GE_OQ);
+            if (_mm256_movemask_pd(has_roots) == 0)
+            {
+                index = _mm256_add_pd(index, step);
+                continue;
+            }
+
+            __m256d sqrtd = _mm256_sqrt_pd(_mm256_max_pd(disc, zero));
+            __m256d qr = _mm256_sub_pd(_mm256_sub_pd(zero, half_b), _mm256_or_pd(sqrtd, _mm256_and_pd(half_b, sign_bit)));
+            __m256d r0 = _mm256_div_pd(qr, a);
+            __m256d r1 = _mm256_div_pd(c, qr);
+            __m256d t0 = _mm256_min_pd(r0, r1);
+            __m256d t1 = _mm256_max_pd(r0, r1);
+
+            __m256d in0 = _mm256_and_pd(_mm256_cmp_pd(t0, t_min, _CMP_GT_OQ), _mm256_cmp_pd(t0, best_t, _CMP_LT_OQ));
+            __m256d in1 = _mm256_and_pd(_mm256_cmp_pd(t1, t_min, _CMP_GT_OQ), _mm256_cmp_pd(t1, best_t, _CMP_LT_OQ));
+            __m256d t = _mm256_blendv_pd(t1, t0, in0);
+            __m256d take = _mm256_and_pd(_mm256_and_pd(has_roots, _mm256_cmp_pd(qr, zero, _CMP_NEQ_OQ)), _mm256_or_pd(in0, in1));
+
+            best_t = _mm256_blendv_pd(best_t, t, take);
+            best_index = _mm256_blendv_pd(best_index, index, take);
+            index = _mm256_add_pd(index, step);
+        }
+
+        double lane_t[lanes], lane_index[lanes];
+        _mm256_storeu_pd(lane_t, best_t);
+        _mm256_storeu_pd(lane_index, best_index);
+        return finish(b, q, n, lane_t, lane_index, lanes, closest);
+    }
+
+    RT_TARGET("avx512f")
+    static int closest_avx512(const sphere_batch& b, const query& q, double& closest)
+    {
+        const int lanes = 8;
+        int n = b.size() / lanes * lanes;
+
+        __m512d ox = _mm512_set1_pd(q.origin[0]), oy = _mm512_set1_pd(q.origin[1]), oz = _mm512_set1_pd(q.origin[2]);
+        __m512d dx = _mm512_set1_pd(q.dir[0]), dy = _mm512_set1_pd(q.dir[1]), dz = _mm512_set1_pd(q.dir[2]);
+        __m512d a = _mm512_set1_pd(q.a);
+        __m512d t_min = _mm512_set1_pd(q.t_min);
+        __m512d zero = _mm512_setzero_pd();
+        __m512i sign_bit = _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ull));
+
+        __m512d best_t = _mm512_set1_pd(closest);
+        __m512d best_index = _mm512_set1_pd(-1);
+        __m512d index = _mm512_set_pd(7, 6, 5, 4, 3, 2, 1, 0);
+        __m512d step = _mm512_set1_pd(lanes);
+
+        for (int i = 0; i < n; i += lanes)
+        {
+            __m512d ocx = _mm512_sub_pd(ox, _mm512_loadu_pd(&b.cx[i]));
+            __m512d ocy = _mm512_sub_pd(oy, _mm512_loadu_pd(&b.cy[i]));
+            __m512d ocz = _mm512_sub_pd(oz, _mm512_loadu_pd(&b.cz[i]));
+            __m512d r = _mm512_loadu_pd(&b.radii[i]);
+
+            __m512d half_b = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, dx), _mm512_mul_pd(ocy, dy)), _mm512_mul_pd(ocz, dz));
+            __m512d r2 = _mm512_mul_pd(r, r);
+            __m512d c = _mm512_sub_pd(_mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(ocx, ocx), _mm512_mul_pd(ocy, ocy)), _mm512_mul_pd(ocz, ocz)), r2);
+
+            __m512d s = _mm512_div_pd(half_b, a);
+            __m512d lx = _mm512_sub_pd(ocx, _mm512_mul_pd(s, dx));
+            __m512d ly = _mm512_sub_pd(ocy, _mm512_mul_pd(s, dy));
+            __m512d lz = _mm512_sub_pd(ocz, _mm512_mul_pd(s, dz));
+            __m512d l2 = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(lx, lx), _mm512_mul_pd(ly, ly)), _mm512_mul_pd(lz, lz));
+            __m512d disc = _mm512_mul_pd(a, _mm512_sub_pd(r2, l2));
+            __mmask8 has_roots = _mm512_cmp_pd_mask(disc, zero, _CMP_GE_OQ);
+            if (has_roots == 0)
+            {
+                index = _mm512_add_pd(index, step);
+                continue;
+            }
+
+            // The sign bit is moved with integer ops: AVX-512F has no double-precision and/or.
+            __m512d sqrtd = _mm512_sqrt_pd(_mm512_max_pd(disc, zero));
+            __m512i half_b_sign = _mm512_and_si512(_mm512_castpd_si512(half_b), sign_bit);
+            __m512d signed_sqrtd = _mm512_castsi512_pd(_mm512_or_si512(_mm512_castpd_si512(sqrtd), half_b_sign));
+            __m512d qr = _mm512_sub_pd(_mm512_sub_pd(zero, half_b), signed_sqrtd);
+            __m512d r0 = _mm512_div_pd(qr, a);
+            __m512d r1 = _mm512_div_pd(c, qr);
+            __m512d t0 = _mm512_min_pd(r0, r1);
+            __m512d t1 = _mm512_max_pd(r0, r1);
+
+            __mmask8 in0 = _mm512_cmp_pd_mask(t0, t_min, _CMP_GT_OQ) & _mm512_cmp_pd_mask(t0, best_t, _CMP_LT_OQ);
+            __mmask8 in1 = _mm512_cmp_pd_mask(t1, t_min, _CMP_GT_OQ) & _mm512_cmp_pd_mask(t1, best_t, _CMP_LT_OQ);
+            __m512d t = _mm512_mask_blend_pd(in0, t1, t0);
+            __mmask8 take = has_roots & _mm512_cmp_pd_mask(qr, zero, _CMP_NEQ_OQ) & (in0 | in1);
+
+            best_t = _mm512_mask_blend_pd(take, best_t, t);
+            best_index = _mm512_mask_blend_pd(take, best_index, index);
+            index = _mm512_add_pd(index, step);
+        }
+
+        double lane_t[lanes], lane_index[lanes];
+        _mm512_storeu_pd(lane_t, best_t);
+        _mm512_storeu_pd(lane_index, best_index);
+        return finish(b, q, n, lane_t, lane_index, lanes, closest);
+    }
+#endif
+};
+
+#endif // !SPHERE_BATCH_H
@@ -0,0 +1,195 @@
+#ifndef TILE_SCHEDULER_H
+#define TILE_SCHEDULER_H
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class tile
+{
+public:
+    int x0, y0;     // Upper-left pixel (inclusive)
+    int x1, y1;     // Lower-right pixel (exclusive)
+};
+
+class thread_stats
+{
+public:
+    int tiles_rendered = 0;
+    int tiles_stolen = 0;
+    double busy_seconds = 0;    // Time spent inside the tile callback
+    double idle_seconds = 0;    // Time spent looking for work or waiting for other threads
+};
+
+class tile_scheduler
+{
+public:
+    tile_scheduler(int image_width, int image_height, int tile_size, int num_threads)
+        : width(image_width), height(image_height),
+          size(tile_size < 1 ? 1 : tile_size),
+          thread_count(num_threads < 1 ? 1 : num_threads)
+    {
+
+    }
+
+    int tile_count() const
+    {
+        return ((width + size - 1) / size) * ((height + size - 1) / size);
+    }
+
+    int threads() const { return thread_count; }
+
+    // Renders every tile exactly once. `render_tile` is called as render_tile(tile, thread_index)
+    // from the worker threads and must only write to pixels inside the tile it was given.
+    template <typename TileFunc>
+    void run(TileFunc render_tile)
+    {
+        using clock = std::chrono::steady_clock;
+
+        // Each worker starts with a contiguous run of tiles so neighbouring tiles stay on one
+        // thread; threads that run out of work steal from the far end of another thread's run.
+        std::vector<work_queue> queues(thread_count);
+        int total = tile_count();
+        int index = 0;
+        for (int y = 0; y < height; y += size)
+        {
+            for (int x = 0; x < width; x += size)
+            {
+                tile t{ x, y, std::min(x + size, width), std::min(y + size, height) };
+                int owner = static_cast<int>(static_cast<long long>(index) * thread_count / total);
+                queues[owner].tiles.push_back(t);
+                ++index;
+            }
+        }
+
+        per_thread.assign(thread_count, thread_stats());
+
+        auto start = clock::now();
+
+        std::vector<std::thread> workers;
+        for (int t = 0; t < thread_count; ++t)
+        {
+            workers.emplace_back([this, t, &queues, &render_tile]() {
+                thread_stats& stats = per_thread[t];
+                tile next;
+                bool stolen = false;
+
+                while (take(queues, t, next, stolen))
+                {
+                    auto tile_start = clock::now();
+                    render_tile(next, t);
+                    stats.busy_seconds += std::chrono::duration<double>(clock::now() - tile_start).count();
+
+                    stats.tiles_rendered++;
+                    if (stolen)
+                        stats.tiles_stolen++;
+                }
+                });
+        }
+
+        for (auto& worker : workers)
+        {
+            worker.join();
+        }
+
+        elapsed = std::chrono::duration<double>(clock::now() - start).count();
+
+        for (auto& stats : per_thread)
+        {
+            stats.idle_seconds = std::max(0.0, elapsed - stats.busy_seconds);
+        }
+    }
+
+    const std::vector<thread_stats>& stats() const { return per_thread; }
+
+    double wall_seconds() const { return elapsed; }
+
+    void print_stats(std::ostream& out) const
+    {
+        double total_busy = 0;
+        double max_busy = 0;
+        for (const auto& stats : per_thread)
+        {
+            total_busy += stats.busy_seconds;
+            max_busy = std::max(max_busy, stats.busy_seconds);
+        }
+        double mean_busy = total_busy / thread_count;
+
+        out << thread_count << " threads, " << tile_count() << " tiles of " << size << "x" << size
+            << ", " << std::fixed << std::setprecision(3) << elapsed << "s wall\n";
+        out << "thread   tiles  stolen    busy(s)    idle(s)   util\n";
+        for (int t = 0; t < thread_count; ++t)
+        {
+            const thread_stats& stats = per_thread[t];
+            double util = elapsed > 0 ? 100.0 * stats.busy_seconds / elapsed : 0.0;
+            out << std::setw(6) << t
+                << std::setw(8) << stats.tiles_rendered
+                << std::setw(8) << stats.tiles_stolen
+                << std::setw(11) << stats.busy_seconds
+                << std::setw(11) << stats.idle_seconds
+                << std::setw(6) << std::setprecision(1) << util << "%\n"
+                << std::setprecision(3);
+        }
+
+        // 1.0 means every thread did the same amount of work.
+        out << "load balance (max busy / mean busy): "
+            << (mean_busy > 0 ? max_busy / mean_busy : 1.0) << '\n';
+        out.unsetf(std::ios_base::floatfield);
+    }
+
+private:
+    class work_queue
+    {
+    public:
+        std::mutex lock;
+        std::deque<tile> tiles;
+    };
+
+    int width;
+    int height;
+    int size;
+    int thread_count;
+
+    std::vector<thread_stats> per_thread;
+    double elapsed = 0;
+
+    static bool take(std::vector<work_queue>& queues, int self, tile& out, bool& stolen)
+    {
+        // Work from the front of our own queue first.
+        {
+            std::lock_guard<std::mutex> guard(queues[self].lock);
+            if (!queues[self].tiles.empty())
+            {
+                out = queues[self].tiles.front();
+                queues[self].tiles.pop_front();
+                stolen = false;
+                return true;
+            }
+        }
+
+        // Then steal from the back of the other queues. No tiles are added after the
+        // run starts, so once every queue is empty there is nothing left to do.
+        int n = static_cast<int>(queues.size());
+        for (int k = 1; k < n; ++k)
+        {
+            work_queue& victim = queues[(self + k) % n];
+            std::lock_guard<std::mutex> guard(victim.lock);
+            if (!victim.tiles.empty())
+            {
+                out = victim.tiles.back();
+                victim.tiles.pop_back();
+                stolen = true;
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
+#endif // !TILE_SCHEDULER_H
@@ -0,0 +1,146 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Timeline of what each thread was doing: scene and BVH builds, tiles, scanlines, preview
+// updates and file output. Written in the Chrome trace event format, so it opens in
+// chrome://tracing or ui.perfetto.dev, where gaps between a worker's tiles show up as idle time.
+//
+// Recording is off until enable() is called. Events are coarse (a tile is thousands of rays),
+// so one lock per event costs nothing measurable.
+class trace_recorder
+{
+public:
+    trace_recorder() : origin(std::chrono::steady_clock::now())
+    {
+
+    }
+
+    void enable() { on = true; }
+    bool enabled() const { return on; }
+
+    // Microseconds since the recorder was created.
+    double now() const
+    {
+        return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    // Adds a span on the calling thread. `args` is the body of a JSON object, e.g. "\"x\": 3".
+    void record(const char* category, std::string name, double start, double end, std::string args = std::string())
+    {
+        if (!on)
+            return;
+        int tid = thread_id();
+        std::lock_guard<std::mutex> lock(mutex);
+        events.push_back({ category, std::move(name), std::move(args), tid, start, end - start });
+    }
+
+    // Label for the calling thread in the viewer.
+    void name_thread(const std::string& name)
+    {
+        if (!on)
+            return;
+        int tid = thread_id();
+        std::lock_guard<std::mutex> lock(mutex);
+        thread_names[tid] = name;
+    }
+
+    bool write(const std::string& path) const
+    {
+        std::ofstream out(path);
+        if (!out)
+            return false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        out << std::fixed << std::setprecision(3);
+        out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+        bool first = true;
+        for (const auto& named : thread_names)
+        {
+            out << (first ? "" : ",\n") << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << named.first
+                << ", \"args\": {\"name\": \"" << named.second << "\"}}";
+            first = false;
+        }
+        for (const event& e : events)
+        {
+            out << (first ? "" : ",\n") << "{\"name\": \"" << e.name << "\", \"cat\": \"" << e.category
+                << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << e.tid << ", \"ts\": " << e.start << ", \"dur\": " << e.duration;
+            if (!e.args.empty())
+                out << ", \"args\": {" << e.args << "}";
+            out << "}";
+            first = false;
+        }
+        out << "\n]}\n";
+        return static_cast<bool>(out);
+    }
+
+private:
+    class event
+    {
+    public:
+        const char* category;
+        std::string name;       // Names and args are written as they are; keep them free of quotes
+        std::string args;
+        int tid;
+        double start;
+        double duration;
+    };
+
+    std::chrono::steady_clock::time_point origin;
+    bool on = false;
+    mutable std::mutex mutex;
+    std::vector<event> events;
+    std::map<int, std::string> thread_names;
+    std::atomic<int> next_thread_id{ 0 };
+
+    int thread_id()
+    {
+        // Small ids in order of first use; the viewer sorts threads by id.
+        static thread_local int id = next_thread_id++;
+        return id;
+    }
+};
+
+inline trace_recorder& render_trace()
+{
+    static trace_recorder recorder;
+    return recorder;
+}
+
+// Records the lifetime of the scope as one span on the calling thread.
+class trace_scope
+{
+public:
+    trace_scope(const char* category, const char* name, std::string args = std::string())
+        : category(category), name(name), args(std::move(args)),
+          start(render_trace().enabled() ? render_trace().now() : 0)
+    {
+
+    }
+
+    ~trace_scope()
+    {
+        if (render_trace().enabled())
+            render_trace().record(category, name, start, render_trace().now(), std::move(args));
+    }
+
+    trace_scope(const trace_scope&) = delete;
+    trace_scope& operator=(const trace_scope&) = delete;
+
+private:
+    const char* category;
+    const char* name;
+    std::string args;
+    double start;
+};
+
+#endif // !TRACE_H
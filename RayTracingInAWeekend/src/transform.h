@@ -0,0 +1,132 @@
+#ifndef TRANSFORM_H
+#define TRANSFORM_H
+
+#include "common.h"
+
+#include "aabb.h"
+
+#include <cmath>
+
+// Affine transform stored as the top three rows of a 4x4 matrix: a 3x3 linear part and a
+// translation column. Products apply right to left, so (a * b) applies b first.
+class affine_transform
+{
+public:
+    real m[3][4];
+
+    static affine_transform identity()
+    {
+        affine_transform t;
+        for (int r = 0; r < 3; r++)
+            for (int c = 0; c < 4; c++)
+                t.m[r][c] = r == c ? real(1) : real(0);
+        return t;
+    }
+
+    static affine_transform translation(const vec3& offset)
+    {
+        affine_transform t = identity();
+        for (int r = 0; r < 3; r++)
+            t.m[r][3] = offset[r];
+        return t;
+    }
+
+    static affine_transform scaling(real s)
+    {
+        affine_transform t = identity();
+        for (int r = 0; r < 3; r++)
+            t.m[r][r] = s;
+        return t;
+    }
+
+    static affine_transform rotation(const vec3& axis, double degrees)
+    {
+        // Rodrigues' formula, counterclockwise when looking down the axis towards the origin.
+        vec3 a = unit_vector(axis);
+        double theta = degrees_to_radians(degrees);
+        double c = std::cos(theta), s = std::sin(theta), k = 1 - c;
+        double x = a.x(), y = a.y(), z = a.z();
+
+        affine_transform t = identity();
+        t.m[0][0] = real(c + x * x * k);     t.m[0][1] = real(x * y * k - z * s); t.m[0][2] = real(x * z * k + y * s);
+        t.m[1][0] = real(y * x * k + z * s); t.m[1][1] = real(c + y * y * k);     t.m[1][2] = real(y * z * k - x * s);
+        t.m[2][0] = real(z * x * k - y * s); t.m[2][1] = real(z * y * k + x * s); t.m[2][2] = real(c + z * z * k);
+        return t;
+    }
+
+    affine_transform operator*(const affine_transform& b) const
+    {
+        affine_transform t;
+        for (int r = 0; r < 3; r++)
+        {
+            for (int c = 0; c < 4; c++)
+            {
+                real v = m[r][0] * b.m[0][c] + m[r][1] * b.m[1][c] + m[r][2] * b.m[2][c];
+                t.m[r][c] = c == 3 ? v + m[r][3] : v;
+            }
+        }
+        return t;
+    }
+
+    affine_transform inverse() const
+    {
+        // Inverse of the linear part by cofactors; the translation becomes -inverse * offset.
+        real c00 = m[1][1] * m[2][2] - m[1][2] * m[2][1];
+        real c01 = m[1][2] * m[2][0] - m[1][0] * m[2][2];
+        real c02 = m[1][0] * m[2][1] - m[1][1] * m[2][0];
+        real inv_det = 1 / (m[0][0] * c00 + m[0][1] * c01 + m[0][2] * c02);
+
+        affine_transform t;
+        t.m[0][0] = c00 * inv_det;
+        t.m[0][1] = (m[0][2] * m[2][1] - m[0][1] * m[2][2]) * inv_det;
+        t.m[0][2] = (m[0][1] * m[1][2] - m[0][2] * m[1][1]) * inv_det;
+        t.m[1][0] = c01 * inv_det;
+        t.m[1][1] = (m[0][0] * m[2][2] - m[0][2] * m[2][0]) * inv_det;
+        t.m[1][2] = (m[0][2] * m[1][0] - m[0][0] * m[1][2]) * inv_det;
+        t.m[2][0] = c02 * inv_det;
+        t.m[2][1] = (m[0][1] * m[2][0] - m[0][0] * m[2][1]) * inv_det;
+        t.m[2][2] = (m[0][0] * m[1][1] - m[0][1] * m[1][0]) * inv_det;
+        for (int r = 0; r < 3; r++)
+            t.m[r][3] = -(t.m[r][0] * m[0][3] + t.m[r][1] * m[1][3] + t.m[r][2] * m[2][3]);
+        return t;
+    }
+
+    point3 apply_point(const point3& p) const
+    {
+        return point3(m[0][0] * p.x() + m[0][1] * p.y() + m[0][2] * p.z() + m[0][3],
+                      m[1][0] * p.x() + m[1][1] * p.y() + m[1][2] * p.z() + m[1][3],
+                      m[2][0] * p.x() + m[2][1] * p.y() + m[2][2] * p.z() + m[2][3]);
+    }
+
+    vec3 apply_vector(const vec3& v) const
+    {
+        return vec3(m[0][0] * v.x() + m[0][1] * v.y() + m[0][2] * v.z(),
+                    m[1][0] * v.x() + m[1][1] * v.y() + m[1][2] * v.z(),
+                    m[2][0] * v.x() + m[2][1] * v.y() + m[2][2] * v.z());
+    }
+
+    vec3 apply_transposed(const vec3& v) const
+    {
+        // Transposed linear part: on the inverse transform, this carries normals to world space.
+        return vec3(m[0][0] * v.x() + m[1][0] * v.y() + m[2][0] * v.z(),
+                    m[0][1] * v.x() + m[1][1] * v.y() + m[2][1] * v.z(),
+                    m[0][2] * v.x() + m[1][2] * v.y() + m[2][2] * v.z());
+    }
+
+    aabb apply_box(const aabb& box) const
+    {
+        // Box around the eight transformed corners.
+        aabb result;
+        for (int corner = 0; corner < 8; corner++)
+        {
+            point3 p(corner & 1 ? box.x.max : box.x.min,
+                     corner & 2 ? box.y.max : box.y.min,
+                     corner & 4 ? box.z.max : box.z.min);
+            point3 q = apply_point(p);
+            result = aabb(result, aabb(q, q));
+        }
+        return result;
+    }
+};
+
+#endif // !TRANSFORM_H
@@ -0,0 +1,64 @@
+#ifndef TRIANGLE_H
+#define TRIANGLE_H
+
+#include "hittable.h"
+#include "vec3.h"
+
+class triangle : public hittable
+{
+public:
+    triangle(const point3& _v0, const point3& _v1, const point3& _v2, shared_ptr<material> _material)
+        : v0(_v0), edge1(_v1 - _v0), edge2(_v2 - _v0), mat(_material)
+    {
+        normal = unit_vector(cross(edge1, edge2));
+
+        // A triangle in an axis-aligned plane has a flat box, which the slab test can miss;
+        // give every axis some thickness.
+        aabb box(aabb(_v0, _v1), aabb(_v2, _v2));
+        const real min_size = real(1e-4);
+        bbox = aabb(box.x.size() < min_size ? box.x.expand(min_size) : box.x,
+                    box.y.size() < min_size ? box.y.expand(min_size) : box.y,
+                    box.z.size() < min_size ? box.z.expand(min_size) : box.z);
+    }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        // Moller-Trumbore: solves for the distance and two barycentric coordinates at once.
+        vec3 pvec = cross(r.direction(), edge2);
+        auto det = dot(edge1, pvec);
+        if (det == 0)
+            return false;
+        auto inv_det = 1 / det;
+
+        vec3 tvec = r.origin() - v0;
+        auto u = dot(tvec, pvec) * inv_det;
+        if (u < 0 || u > 1)
+            return false;
+
+        vec3 qvec = cross(tvec, edge1);
+        auto v = dot(r.direction(), qvec) * inv_det;
+        if (v < 0 || u + v > 1)
+            return false;
+
+        auto t = dot(edge2, qvec) * inv_det;
+        if (!ray_t.surrounds(t))
+            return false;
+
+        rec.t = t;
+        rec.p = r.at(t);
+        rec.set_face_normal(r, normal);
+        rec.mat = mat.get();
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+private:
+    point3 v0;
+    vec3 edge1, edge2;
+    vec3 normal;
+    shared_ptr<material> mat;
+    aabb bbox;
+};
+
+#endif // !TRIANGLE_H
@@ -0,0 +1,671 @@
+#ifndef TRIANGLE_MESH_H
+#define TRIANGLE_MESH_H
+
+#include "common.h"
+
+#include "bvh.h"
+#include "hittable.h"
+#include "parallel.h"
+#include "radix_sort.h"
+#include "render_stats.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Indexed triangle mesh: shared float vertex positions (and optional per-vertex normals and
+// UVs), three 32-bit indices per triangle, and a BVH of its own over the triangles. A triangle
+// costs 12 bytes of indices plus its share of vertices (about half a vertex in a closed mesh)
+// and about 0.6 BVH nodes of 32 bytes with float bounds: some 40 bytes a triangle with normals,
+// so 10M triangles take about 400 MB instead of the gigabytes separate triangle objects would.
+//
+// build() makes the BVH with the same strategies and threading as bvh: binned SAH or LBVH,
+// parallel chunks near the root and parallel subtrees below. The SAH build partitions the index
+// triples themselves instead of a separate array of triangle references, so building adds
+// little to the mesh's final size.
+//
+// Triangles are intersected with the watertight algorithm of Woop, Benthin and Wald (JCGT
+// 2013): the ray is sheared to look down +z and the edge functions are evaluated in 2D, so a
+// ray through a shared edge or vertex hits at least one of the triangles around it instead of
+// slipping between them. The boxes are tested with a slightly widened far distance for the same
+// reason (Ize, JCGT 2013). The whole mesh is one object to the scene's acceleration structure.
+class triangle_mesh : public hittable
+{
+public:
+    static const int bin_count = 12;
+    static const int max_leaf_size = 4;
+    static const int max_depth = 64;
+    static constexpr float node_cost = 3;   // Cost of visiting a node relative to testing a triangle
+
+    // positions holds x, y, z per vertex and indices three vertices per triangle, counterclockwise
+    // seen from the front. normals (x, y, z per vertex) and uvs (u, v per vertex) may be empty;
+    // without normals the mesh is flat shaded.
+    triangle_mesh(std::vector<float> _positions, std::vector<std::uint32_t> _indices, shared_ptr<material> _material,
+                  std::vector<float> _normals = std::vector<float>(), std::vector<float> _uvs = std::vector<float>())
+        : hittable(hittable_kind::aggregate), positions(std::move(_positions)), normals(std::move(_normals)), uvs(std::move(_uvs)),
+          indices(std::move(_indices)), mat(std::move(_material))
+    {
+        // Flat meshes get some thickness, as triangle does, for the scene's slab tests.
+        box3f b;
+        for (std::size_t v = 0; v < vertex_count(); v++)
+            b.grow(&positions[3 * v]);
+        const real min_size = real(1e-4);
+        interval axes[3];
+        for (int a = 0; a < 3; a++)
+        {
+            interval i = b.lo[a] <= b.hi[a] ? interval(b.lo[a], b.hi[a]) : interval(0, 0);
+            axes[a] = i.size() < min_size ? i.expand(min_size) : i;
+        }
+        bbox = aabb(axes[0], axes[1], axes[2]);
+    }
+
+    // Builds the mesh's BVH with build_threads threads, 0 uses std::thread::hardware_concurrency(),
+    // by the given strategy, putting the triangles in leaf order. Rays miss the mesh until it is
+    // built; build_acceleration() builds the meshes of a scene along with the scene's own
+    // structure. Building again replaces the tree.
+    void build(int build_threads = 0, bvh_build strategy = bvh_build::sah)
+    {
+        std::vector<node>().swap(nodes);
+        int count = static_cast<int>(triangle_count());
+        if (count == 0)
+            return;
+
+        // Only the nodes written are resident, so the reservation needs no shrinking afterwards:
+        // the SAH tree has about 0.6 nodes a triangle, the LBVH one, with smaller leaves, about 1.
+        int threads = resolve_threads(build_threads);
+        nodes.reserve(strategy == bvh_build::lbvh ? 2 * static_cast<std::size_t>(count) - 1 : static_cast<std::size_t>(count));
+        nodes.push_back(node());
+        if (strategy == bvh_build::lbvh)
+            build_lbvh(threads);
+        else
+            build_node(nodes, 0, 0, count, 0, threads);
+    }
+
+    bool is_built() const { return !nodes.empty(); }
+
+    bool hit(const ray& r, interval ray_t, hit_record& rec) const override
+    {
+        if (nodes.empty())
+            return false;
+
+        ray_setup rs(r);
+        real t_near;
+        if (!hit_box(nodes[0].box, rs, ray_t.min, ray_t.max, t_near))
+            return false;
+
+        std::uint32_t stack[max_depth];
+        int stack_size = 0;
+        std::uint32_t current = 0;
+
+        real closest = ray_t.max;
+        std::uint32_t hit_triangle = 0;
+        bool hit_anything = false;
+        real hit_b0 = 0, hit_b1 = 0, hit_b2 = 0;
+
+        while (true)
+        {
+            const node& n = nodes[current];
+            RT_COUNT(thread_counters().node_visits++);
+
+            if (n.count > 0)
+            {
+                RT_COUNT(thread_counters().primitive_tests += n.count);
+                for (std::uint32_t k = n.first; k < n.first + n.count; k++)
+                {
+                    real t, b0, b1, b2;
+                    if (intersect(k, rs, ray_t.min, closest, t, b0, b1, b2))
+                    {
+                        closest = t;
+                        hit_triangle = k;
+                        hit_anything = true;
+                        hit_b0 = b0; hit_b1 = b1; hit_b2 = b2;
+                    }
+                }
+            }
+            else
+            {
+                std::uint32_t left = n.first;
+                std::uint32_t right = n.first + 1;
+                real t_left, t_right;
+                bool hit_left = hit_box(nodes[left].box, rs, ray_t.min, closest, t_left);
+                bool hit_right = hit_box(nodes[right].box, rs, ray_t.min, closest, t_right);
+
+                if (hit_left && hit_right)
+                {
+                    if (t_right < t_left)
+                        std::swap(left, right);
+                    stack[stack_size++] = right;
+                    current = left;
+                    continue;
+                }
+                if (hit_left || hit_right)
+                {
+                    current = hit_left ? left : right;
+                    continue;
+                }
+            }
+
+            if (stack_size == 0)
+                break;
+            current = stack[--stack_size];
+        }
+
+        if (!hit_anything)
+            return false;
+
+        const std::uint32_t* tri = &indices[3 * static_cast<std::size_t>(hit_triangle)];
+        point3 p0 = position(tri[0]), p1 = position(tri[1]), p2 = position(tri[2]);
+        vec3 geometric = unit_vector(cross(p1 - p0, p2 - p0));
+
+        rec.t = closest;
+        rec.p = r.at(closest);
+        rec.set_face_normal(r, geometric);
+        if (!normals.empty())
+        {
+            // Shading normal, turned to the side of the surface the ray is on.
+            vec3 shading = unit_vector(hit_b0 * normal(tri[0]) + hit_b1 * normal(tri[1]) + hit_b2 * normal(tri[2]));
+            rec.normal = dot(shading, rec.normal) < 0 ? -shading : shading;
+        }
+        rec.mat = mat.get();
+        return true;
+    }
+
+    aabb bounding_box() const override { return bbox; }
+
+    std::size_t triangle_count() const { return indices.size() / 3; }
+    std::size_t vertex_count() const { return positions.size() / 3; }
+    bool has_uvs() const { return !uvs.empty(); }
+
+    std::size_t memory_bytes() const
+    {
+        // The node array's unused reservation is never touched, so it is left out.
+        return sizeof(*this) + positions.capacity() * sizeof(float) + normals.capacity() * sizeof(float)
+            + uvs.capacity() * sizeof(float) + indices.capacity() * sizeof(std::uint32_t)
+            + nodes.size() * sizeof(node);
+    }
+
+private:
+    class box3f
+    {
+    public:
+        float lo[3] = { std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity(), std::numeric_limits<float>::infinity() };
+        float hi[3] = { -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity(), -std::numeric_limits<float>::infinity() };
+
+        void grow(const float* p)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = std::min(lo[a], p[a]);
+                hi[a] = std::max(hi[a], p[a]);
+            }
+        }
+
+        void grow(const box3f& b)
+        {
+            for (int a = 0; a < 3; a++)
+            {
+                lo[a] = std::min(lo[a], b.lo[a]);
+                hi[a] = std::max(hi[a], b.hi[a]);
+            }
+        }
+
+        float center(int a) const { return 0.5f * (lo[a] + hi[a]); }
+
+        float area() const
+        {
+            float dx = hi[0] - lo[0], dy = hi[1] - lo[1], dz = hi[2] - lo[2];
+            if (dx < 0 || dy < 0 || dz < 0)
+                return 0;
+            return 2 * (dx * dy + dy * dz + dz * dx);
+        }
+    };
+
+    class node
+    {
+    public:
+        box3f box;
+        std::uint32_t first = 0;    // Leaf: first triangle. Interior: left child, the right one is first + 1.
+        std::uint32_t count = 0;    // Triangles in a leaf, 0 for interior nodes.
+    };
+
+    class bin
+    {
+    public:
+        // Bounds of some triangles and of their centers.
+        box3f box;
+        box3f centroids;
+        std::uint32_t count = 0;
+
+        void add(const box3f& triangle)
+        {
+            float c[3] = { triangle.center(0), triangle.center(1), triangle.center(2) };
+            box.grow(triangle);
+            centroids.grow(c);
+            count++;
+        }
+
+        void add(const bin& b)
+        {
+            box.grow(b.box);
+            centroids.grow(b.centroids);
+            count += b.count;
+        }
+    };
+
+    class ray_setup
+    {
+    public:
+        // Per-ray constants for the box and watertight triangle tests.
+        real origin[3];
+        real inv_dir[3];
+        int kx, ky, kz;         // Axes after the permutation that makes kz the dominant direction
+        real sx, sy, sz;        // Shear onto the +z axis
+
+        explicit ray_setup(const ray& r)
+        {
+            point3 o = r.origin();
+            vec3 d = r.direction();
+            for (int a = 0; a < 3; a++)
+            {
+                origin[a] = o[a];
+                inv_dir[a] = 1 / d[a];
+            }
+
+            kz = std::fabs(d.x()) > std::fabs(d.y()) ? (std::fabs(d.x()) > std::fabs(d.z()) ? 0 : 2)
+                                                     : (std::fabs(d.y()) > std::fabs(d.z()) ? 1 : 2);
+            kx = kz == 2 ? 0 : kz + 1;
+            ky = kx == 2 ? 0 : kx + 1;
+            if (d[kz] < 0)
+                std::swap(kx, ky);     // Keeps the winding, so the edge functions keep their sign
+
+            sx = d[kx] / d[kz];
+            sy = d[ky] / d[kz];
+            sz = 1 / d[kz];
+        }
+    };
+
+    std::vector<float> positions;
+    std::vector<float> normals;
+    std::vector<float> uvs;
+    std::vector<std::uint32_t> indices;
+    std::vector<node> nodes;
+    shared_ptr<material> mat;
+    aabb bbox;
+
+    point3 position(std::uint32_t v) const
+    {
+        const float* p = &positions[3 * static_cast<std::size_t>(v)];
+        return point3(p[0], p[1], p[2]);
+    }
+
+    vec3 normal(std::uint32_t v) const
+    {
+        const float* n = &normals[3 * static_cast<std::size_t>(v)];
+        return vec3(n[0], n[1], n[2]);
+    }
+
+    bool intersect(std::uint32_t k, const ray_setup& rs, real t_min, real t_max, real& t, real& b0, real& b1, real& b2) const
+    {
+        const std::uint32_t* tri = &indices[3 * static_cast<std::size_t>(k)];
+        const float* vert[3] = {
+            &positions[3 * static_cast<std::size_t>(tri[0])],
+            &positions[3 * static_cast<std::size_t>(tri[1])],
+            &positions[3 * static_cast<std::size_t>(tri[2])]
+        };
+
+        // Vertices relative to the origin, sheared so the ray runs down +z from (0, 0, 0).
+        real ax = vert[0][rs.kx] - rs.origin[rs.kx], ay = vert[0][rs.ky] - rs.origin[rs.ky], az = vert[0][rs.kz] - rs.origin[rs.kz];
+        real bx = vert[1][rs.kx] - rs.origin[rs.kx], by = vert[1][rs.ky] - rs.origin[rs.ky], bz = vert[1][rs.kz] - rs.origin[rs.kz];
+        real cx = vert[2][rs.kx] - rs.origin[rs.kx], cy = vert[2][rs.ky] - rs.origin[rs.ky], cz = vert[2][rs.kz] - rs.origin[rs.kz];
+        ax -= rs.sx * az; ay -= rs.sy * az;
+        bx -= rs.sx * bz; by -= rs.sy * bz;
+        cx -= rs.sx * cz; cy -= rs.sy * cz;
+
+        // Edge functions: twice the signed areas of the sub-triangles opposite each vertex.
+        real u = cx * by - cy * bx;
+        real v = ax * cy - ay * cx;
+        real w = bx * ay - by * ax;
+        if (u == 0 || v == 0 || w == 0)
+        {
+            // On an edge in this precision: redo the products in double, as the paper does for
+            // floats. A no-op when real is already double.
+            u = static_cast<real>(static_cast<double>(cx) * by - static_cast<double>(cy) * bx);
+            v = static_cast<real>(static_cast<double>(ax) * cy - static_cast<double>(ay) * cx);
+            w = static_cast<real>(static_cast<double>(bx) * ay - static_cast<double>(by) * ax);
+        }
+
+        if ((u < 0 || v < 0 || w < 0) && (u > 0 || v > 0 || w > 0))
+            return false;
+
+        real det = u + v + w;
+        if (det == 0)
+            return false;
+
+        // Barycentric interpolation of the sheared depths gives the distance times det.
+        real scaled_t = u * (rs.sz * az) + v * (rs.sz * bz) + w * (rs.sz * cz);
+        real inv_det = 1 / det;
+        t = scaled_t * inv_det;
+        if (!(t > t_min && t < t_max))
+            return false;
+
+        b0 = u * inv_det;
+        b1 = v * inv_det;
+        b2 = w * inv_det;
+        return true;
+    }
+
+    static bool hit_box(const box3f& b, const ray_setup& rs, real t_min, real t_max, real& t_near)
+    {
+        // Slab test whose far distance is widened by a few rounding errors, so a ray through
+        // a shared edge is not lost between two boxes that both touch it.
+        const real widen = 1 + 4 * std::numeric_limits<real>::epsilon();
+        for (int a = 0; a < 3; a++)
+        {
+            real t0 = (b.lo[a] - rs.origin[a]) * rs.inv_dir[a];
+            real t1 = (b.hi[a] - rs.origin[a]) * rs.inv_dir[a];
+            if (rs.inv_dir[a] < 0)
+                std::swap(t0, t1);
+            t1 *= widen;
+
+            if (t0 > t_min) t_min = t0;
+            if (t1 < t_max) t_max = t1;
+            if (t_max < t_min)
+                return false;
+        }
+        t_near = t_min;
+        return true;
+    }
+
+    int resolve_threads(int build_threads) const
+    {
+        int threads = build_threads > 0 ? build_threads : static_cast<int>(std::thread::hardware_concurrency());
+        return std::max(threads, 1);
+    }
+
+    box3f triangle_box(int k) const
+    {
+        const std::uint32_t* tri = &indices[3 * static_cast<std::size_t>(k)];
+        box3f b;
+        for (int c = 0; c < 3; c++)
+            b.grow(&positions[3 * static_cast<std::size_t>(tri[c])]);
+        return b;
+    }
+
+    float triangle_center(int k, int axis) const
+    {
+        // triangle_box(k).center(axis) with one axis loaded.
+        const std::uint32_t* tri = &indices[3 * static_cast<std::size_t>(k)];
+        float a = positions[3 * static_cast<std::size_t>(tri[0]) + axis];
+        float b = positions[3 * static_cast<std::size_t>(tri[1]) + axis];
+        float c = positions[3 * static_cast<std::size_t>(tri[2]) + axis];
+        return 0.5f * (std::min(a, std::min(b, c)) + std::max(a, std::max(b, c)));
+    }
+
+    void swap_triangles(int a, int b)
+    {
+        std::swap_ranges(indices.begin() + 3 * static_cast<std::ptrdiff_t>(a), indices.begin() + 3 * static_cast<std::ptrdiff_t>(a) + 3,
+                         indices.begin() + 3 * static_cast<std::ptrdiff_t>(b));
+    }
+
+    template <typename Pred>
+    int partition_triangles(int start, int end, Pred goes_left)
+    {
+        // std::partition over the triangles' index triples in place, returning the first
+        // triangle on the right.
+        int i = start, j = end;
+        while (true)
+        {
+            while (i < j && goes_left(i))
+                i++;
+            while (i < j && !goes_left(j - 1))
+                j--;
+            if (i >= j)
+                return i;
+            swap_triangles(i, --j);
+            i++;
+        }
+    }
+
+    bin summarize(int start, int end, int threads) const
+    {
+        // Bounds of the triangles in [start, end) and of their centers, in parallel chunks.
+        int count = end - start;
+        int chunks = parallel_chunk_count(count, threads, bvh::parallel_grain);
+        bin whole;
+        std::vector<bin> chunk_bins(static_cast<size_t>(chunks - 1));
+        parallel_chunks(count, threads, bvh::parallel_grain, [&](int s, int e, int chunk) {
+            bin& local = chunk == 0 ? whole : chunk_bins[chunk - 1];
+            for (int k = start + s; k < start + e; k++)
+                local.add(triangle_box(k));
+            });
+        for (const bin& b : chunk_bins)
+            whole.add(b);
+        return whole;
+    }
+
+    void build_node(std::vector<node>& out, int node_index, int start, int end, int depth, int threads,
+                    const bin* range = nullptr)
+    {
+        // Binned SAH as in bvh::build(), with bins computed in parallel chunks near the root and
+        // the halves of a split built as separate tasks further down. `range` is the summary of
+        // [start, end) when the parent's bins already hold it, which saves a pass over the
+        // triangles' vertices at every node.
+        int count = end - start;
+        int chunks = parallel_chunk_count(count, threads, bvh::parallel_grain);
+
+        bin whole = range ? *range : summarize(start, end, threads);
+        const box3f& bounds = whole.box;
+        const box3f& centroids = whole.centroids;
+        out[node_index].box = bounds;
+
+        if (count == 1 || depth >= max_depth - 1)
+        {
+            make_leaf(out, node_index, start, count);
+            return;
+        }
+
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+        {
+            if (centroids.hi[a] - centroids.lo[a] > centroids.hi[axis] - centroids.lo[axis])
+                axis = a;
+        }
+        float extent_min = centroids.lo[axis];
+        float extent = centroids.hi[axis] - extent_min;
+        int mid = start;
+        bin halves[2];
+        bool halves_known = false;
+
+        if (extent <= 0)
+        {
+            if (count <= max_leaf_size)
+            {
+                make_leaf(out, node_index, start, count);
+                return;
+            }
+        }
+        else
+        {
+            bin bins[bin_count];
+            std::vector<bin> chunk_bins(static_cast<size_t>(chunks - 1) * bin_count);
+            float scale = bin_count / extent;
+            parallel_chunks(count, threads, bvh::parallel_grain, [&](int s, int e, int chunk) {
+                bin* local = chunk == 0 ? bins : &chunk_bins[static_cast<size_t>(chunk - 1) * bin_count];
+                for (int k = start + s; k < start + e; k++)
+                {
+                    box3f t = triangle_box(k);
+                    local[bin_of(t.center(axis), extent_min, scale)].add(t);
+                }
+                });
+            for (size_t k = 0; k < chunk_bins.size(); k++)
+                bins[k % bin_count].add(chunk_bins[k]);
+
+            float right_area[bin_count - 1];
+            std::uint32_t right_count[bin_count - 1];
+            box3f right_box;
+            std::uint32_t right_sum = 0;
+            for (int k = bin_count - 1; k > 0; k--)
+            {
+                right_box.grow(bins[k].box);
+                right_sum += bins[k].count;
+                right_area[k - 1] = right_box.area();
+                right_count[k - 1] = right_sum;
+            }
+
+            int best_split = -1;
+            float best_cost = std::numeric_limits<float>::infinity();
+            box3f left_box;
+            std::uint32_t left_sum = 0;
+            for (int k = 0; k < bin_count - 1; k++)
+            {
+                left_box.grow(bins[k].box);
+                left_sum += bins[k].count;
+                if (left_sum == 0 || right_count[k] == 0)
+                    continue;
+
+                float cost = left_sum * left_box.area() + right_count[k] * right_area[k];
+                if (cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_split = k;
+                }
+            }
+
+            // Weighting the nodes above the triangle tests gives fuller leaves: about 0.6 nodes
+            // per triangle instead of 1.1, which renders as fast in a quarter less memory.
+            float leaf_cost = count * bounds.area();
+            float split_cost = node_cost * bounds.area() + best_cost;
+            if (count <= max_leaf_size && leaf_cost <= split_cost)
+            {
+                make_leaf(out, node_index, start, count);
+                return;
+            }
+
+            if (best_split >= 0)
+            {
+                mid = partition_triangles(start, end, [&](int k) {
+                    return bin_of(triangle_center(k, axis), extent_min, scale) <= best_split;
+                    });
+                for (int k = 0; k < bin_count; k++)
+                    halves[k <= best_split ? 0 : 1].add(bins[k]);
+                halves_known = true;
+            }
+        }
+
+        // Without a usable plane the centroids all coincide, so any halving is a median split.
+        if (mid == start || mid == end)
+        {
+            mid = start + count / 2;
+            halves_known = false;
+        }
+
+        int left = static_cast<int>(out.size());
+        out.push_back(node());
+        out.push_back(node());
+        out[node_index].first = static_cast<std::uint32_t>(left);
+        out[node_index].count = 0;
+
+        bvh::build_children(out, left, start, mid, end, threads,
+            [&](std::vector<node>& child_out, int child, int s, int e, int child_threads) {
+                build_node(child_out, child, s, e, depth + 1, child_threads,
+                           halves_known ? &halves[s == start ? 0 : 1] : nullptr);
+            });
+    }
+
+    void build_lbvh(int threads)
+    {
+        // Morton order of the triangle centroids, as bvh::build_lbvh(), then the triangles are
+        // stored in that order and the hierarchy emitted over them.
+        int count = static_cast<int>(triangle_count());
+        int chunks = parallel_chunk_count(count, threads, bvh::parallel_grain);
+
+        std::vector<box3f> chunk_bounds(chunks);
+        parallel_chunks(count, threads, bvh::parallel_grain, [&](int s, int e, int chunk) {
+            box3f cb;
+            for (int k = s; k < e; k++)
+            {
+                box3f t = triangle_box(k);
+                float c[3] = { t.center(0), t.center(1), t.center(2) };
+                cb.grow(c);
+            }
+            chunk_bounds[chunk] = cb;
+            });
+        box3f cb;
+        for (const box3f& b : chunk_bounds)
+            cb.grow(b);
+        aabb centroid_bounds(point3(cb.lo[0], cb.lo[1], cb.lo[2]), point3(cb.hi[0], cb.hi[1], cb.hi[2]));
+
+        std::vector<std::uint64_t> codes(count);
+        std::vector<int> order(count);
+        parallel_chunks(count, threads, bvh::parallel_grain, [&](int s, int e, int) {
+            for (int k = s; k < e; k++)
+            {
+                box3f t = triangle_box(k);
+                codes[k] = bvh::morton_code(point3(t.center(0), t.center(1), t.center(2)), centroid_bounds);
+                order[k] = k;
+            }
+            });
+
+        radix_sort(codes, order, threads);
+
+        std::vector<std::uint32_t> sorted(indices.size());
+        parallel_chunks(count, threads, bvh::parallel_grain, [&](int s, int e, int) {
+            for (int k = s; k < e; k++)
+                for (int c = 0; c < 3; c++)
+                    sorted[3 * static_cast<std::size_t>(k) + c] = indices[3 * static_cast<std::size_t>(order[k]) + c];
+            });
+        indices.swap(sorted);
+        std::vector<std::uint32_t>().swap(sorted);
+        std::vector<int>().swap(order);
+
+        emit_lbvh(codes, nodes, 0, 0, count, 0, threads);
+    }
+
+    void emit_lbvh(const std::vector<std::uint64_t>& codes, std::vector<node>& out, int node_index, int start, int end,
+                   int depth, int threads)
+    {
+        int count = end - start;
+        if (count <= bvh::lbvh_leaf_size || depth >= max_depth - 1)
+        {
+            box3f bounds;
+            for (int k = start; k < end; k++)
+                bounds.grow(triangle_box(k));
+            out[node_index].box = bounds;
+            make_leaf(out, node_index, start, count);
+            return;
+        }
+
+        int mid = bvh::morton_split(codes, start, end);
+
+        int left = static_cast<int>(out.size());
+        out.push_back(node());
+        out.push_back(node());
+        out[node_index].first = static_cast<std::uint32_t>(left);
+        out[node_index].count = 0;
+
+        bvh::build_children(out, left, start, mid, end, threads,
+            [&](std::vector<node>& child_out, int child, int s, int e, int child_threads) {
+                emit_lbvh(codes, child_out, child, s, e, depth + 1, child_threads);
+            });
+
+        out[node_index].box = out[left].box;
+        out[node_index].box.grow(out[left + 1].box);
+    }
+
+    static void make_leaf(std::vector<node>& out, int node_index, int start, int count)
+    {
+        out[node_index].first = static_cast<std::uint32_t>(start);
+        out[node_index].count = static_cast<std::uint32_t>(count);
+    }
+
+    static int bin_of(float c, float min, float scale)
+    {
+        int b = static_cast<int>((c - min) * scale);
+        return b < 0 ? 0 : (b >= bin_count ? bin_count - 1 : b);
+    }
+};
+
+#endif // !TRIANGLE_MESH_H
@@ -1,50 +1,86 @@
 #ifndef VEC3_H
 #define VEC3_H
 
+#include "precision.h"
+#include "vec3_simd.h"
+
 #include <cmath>
 #include <iostream>
 
 using std::sqrt;
+using std::fabs;
+using std::fmin;
+using std::fmax;
 
 class vec3 {
 public:
-    double e[3];
+#if RT_SIMD_VEC3
+    alignas(16) real e[4];
+
+    // Written with one vector store: a wide load of memory just written in narrower pieces
+    // cannot be forwarded from the store buffer and stalls until the stores complete.
+    vec3() { simd4::store(e, simd4::set1(0)); }
+    vec3(real e0, real e1, real e2) { simd4::store(e, simd4::set(e0, e1, e2)); }
+    explicit vec3(simd4::reg v) { simd4::store(e, v); }
+
+    simd4::reg lanes() const { return simd4::load(e); }
+#else
+    real e[3];
 
     vec3() : e{ 0,0,0 } {}
-    vec3(double e0, double e1, double e2) : e{ e0, e1, e2 } {}
+    vec3(real e0, real e1, real e2) : e{ e0, e1, e2 } {}
+#endif
 
-    double x() const { return e[0]; }
-    double y() const { return e[1]; }
-    double z() const { return e[2]; }
+    real x() const { return e[0]; }
+    real y() const { return e[1]; }
+    real z() const { return e[2]; }
 
+#if RT_SIMD_VEC3
+    vec3 operator-() const { return vec3(simd4::negate(lanes())); }
+#else
     vec3 operator-() const { return vec3(-e[0], -e[1], -e[2]); }
-    double operator[](int i) const { return e[i]; }
-    double& operator[](int i) { return e[i]; }
+#endif
+    real operator[](int i) const { return e[i]; }
+    real& operator[](int i) { return e[i]; }
 
     vec3& operator+=(const vec3& v) {
+#if RT_SIMD_VEC3
+        simd4::store(e, simd4::add(lanes(), v.lanes()));
+        return *this;
+#else
         e[0] += v.e[0];
         e[1] += v.e[1];
         e[2] += v.e[2];
         return *this;
+#endif
     }
 
-    vec3& operator*=(double t) {
+    vec3& operator*=(real t) {
+#if RT_SIMD_VEC3
+        simd4::store(e, simd4::mul(lanes(), simd4::set1(t)));
+#else
         e[0] *= t;
         e[1] *= t;
         e[2] *= t;
+#endif
         return *this;
     }
 
-    vec3& operator/=(double t) {
+    vec3& operator/=(real t) {
         return *this *= 1 / t;
     }
 
-    double length() const {
+    real length() const {
         return sqrt(length_squared());
     }
 
-    double length_squared() const {
+    real length_squared() const {
+#if RT_SIMD_VEC3
+        simd4::reg v = lanes();
+        return simd4::sum3(simd4::mul(v, v));
+#else
         return e[0] * e[0] + e[1] * e[1] + e[2] * e[2];
+#endif
     }
 
     bool near_zero()
@@ -55,12 +91,12 @@ public:
 
     static vec3 random()
     {
-        return vec3(random_double(), random_double(), random_double());
+        return vec3(real(random_double()), real(random_double()), real(random_double()));
     }
 
-    static vec3 random(double min, double max)
+    static vec3 random(real min, real max)
     {
-        return vec3(random_double(min, max), random_double(min, max), random_double(min, max));
+        return vec3(real(random_double(min, max)), real(random_double(min, max)), real(random_double(min, max)));
     }
 };
 
@@ -74,6 +110,26 @@ inline std::ostream& operator<<(std::ostream& out, const vec3& v) {
     return out << v.e[0] << ' ' << v.e[1] << ' ' << v.e[2];
 }
 
+#if RT_SIMD_VEC3
+
+inline vec3 operator+(const vec3& u, const vec3& v) {
+    return vec3(simd4::add(u.lanes(), v.lanes()));
+}
+
+inline vec3 operator-(const vec3& u, const vec3& v) {
+    return vec3(simd4::sub(u.lanes(), v.lanes()));
+}
+
+inline vec3 operator*(const vec3& u, const vec3& v) {
+    return vec3(simd4::mul(u.lanes(), v.lanes()));
+}
+
+inline vec3 operator*(real t, const vec3& v) {
+    return vec3(simd4::mul(simd4::set1(t), v.lanes()));
+}
+
+#else
+
 inline vec3 operator+(const vec3& u, const vec3& v) {
     return vec3(u.e[0] + v.e[0], u.e[1] + v.e[1], u.e[2] + v.e[2]);
 }
@@ -86,28 +142,40 @@ inline vec3 operator*(const vec3& u, const vec3& v) {
     return vec3(u.e[0] * v.e[0], u.e[1] * v.e[1], u.e[2] * v.e[2]);
 }
 
-inline vec3 operator*(double t, const vec3& v) {
+inline vec3 operator*(real t, const vec3& v) {
     return vec3(t * v.e[0], t * v.e[1], t * v.e[2]);
 }
 
-inline vec3 operator*(const vec3& v, double t) {
+#endif
+
+inline vec3 operator*(const vec3& v, real t) {
     return t * v;
 }
 
-inline vec3 operator/(vec3 v, double t) {
+inline vec3 operator/(vec3 v, real t) {
     return (1 / t) * v;
 }
 
-inline double dot(const vec3& u, const vec3& v) {
+inline real dot(const vec3& u, const vec3& v) {
+#if RT_SIMD_VEC3
+    return simd4::sum3(simd4::mul(u.lanes(), v.lanes()));
+#else
     return u.e[0] * v.e[0]
         + u.e[1] * v.e[1]
         + u.e[2] * v.e[2];
+#endif
 }
 
 inline vec3 cross(const vec3& u, const vec3& v) {
+#if RT_SIMD_VEC3
+    simd4::reg a = u.lanes();
+    simd4::reg b = v.lanes();
+    return vec3(simd4::sub(simd4::mul(simd4::yzx(a), simd4::zxy(b)), simd4::mul(simd4::zxy(a), simd4::yzx(b))));
+#else
     return vec3(u.e[1] * v.e[2] - u.e[2] * v.e[1],
         u.e[2] * v.e[0] - u.e[0] * v.e[2],
         u.e[0] * v.e[1] - u.e[1] * v.e[0]);
+#endif
 }
 
 inline vec3 unit_vector(vec3 v) {
@@ -118,7 +186,7 @@ inline vec3 random_in_unit_disk()
 {
     while (true)
     {
-        auto p = vec3(random_double(-1, 1), random_double(-1, 1), 0);
+        auto p = vec3(real(random_double(-1, 1)), real(random_double(-1, 1)), 0);
         if (p.length_squared() < 1)
             return p;
     }
@@ -157,10 +225,10 @@ vec3 reflect(const vec3& v, const vec3& n)
     return v - 2 * dot(v, n) * n;
 }
 
-inline vec3 refract(const vec3& uv, const vec3& n, double etai_over_etat) {
-    auto cos_theta = fmin(dot(-uv, n), 1.0);
+inline vec3 refract(const vec3& uv, const vec3& n, real etai_over_etat) {
+    auto cos_theta = fmin(dot(-uv, n), real(1));
     vec3 r_out_perp = etai_over_etat * (uv + cos_theta * n);
-    vec3 r_out_parallel = -sqrt(fabs(1.0 - r_out_perp.length_squared())) * n;
+    vec3 r_out_parallel = -sqrt(fabs(1 - r_out_perp.length_squared())) * n;
     return r_out_perp + r_out_parallel;
 }
 
@@ -0,0 +1,89 @@
+#ifndef VEC3_BENCH_H
+#define VEC3_BENCH_H
+
+#include "common.h"
+
+#include <chrono>
+#include <iomanip>
+#include <ostream>
+#include <vector>
+
+// Microbenchmarks for the vec3 operations the renderer spends its time in. Each one runs over
+// arrays small enough to stay in L1, so the numbers measure arithmetic rather than memory, and
+// keeps the fastest of several repetitions. Build with and without RT_SIMD_VEC3 (and with
+// RT_SINGLE_PRECISION) to compare implementations.
+
+class vec3_bench
+{
+public:
+    static const int count = 256;       // Vectors per array: three arrays of 32-byte vec3s fit in L1
+    static const int passes = 8000;     // Passes over the arrays per timed repetition
+    static const int repetitions = 5;
+
+    vec3_bench()
+    {
+        for (int i = 0; i < count; ++i)
+        {
+            a.push_back(vec3::random(-1, 1));
+            b.push_back(unit_vector(vec3::random(-1, 1)));
+        }
+        out.resize(count);
+    }
+
+    void run(std::ostream& log)
+    {
+        log << "vec3 microbenchmarks, " << vec3_backend_name() << ", sizeof(vec3) = " << sizeof(vec3) << '\n';
+
+        report(log, "a + b", [this](int i) { out[i] = a[i] + b[i]; });
+        report(log, "a + t * b", [this](int i) { out[i] = a[i] + real(0.5) * b[i]; });
+        report(log, "a * b", [this](int i) { out[i] = a[i] * b[i]; });
+        report(log, "dot", [this](int i) { out[i][0] = dot(a[i], b[i]); });
+        report(log, "cross", [this](int i) { out[i] = cross(a[i], b[i]); });
+        report(log, "unit_vector", [this](int i) { out[i] = unit_vector(a[i]); });
+        report(log, "reflect", [this](int i) { out[i] = reflect(a[i], b[i]); });
+        report(log, "refract", [this](int i) { out[i] = refract(b[i], unit_vector(a[i]), real(0.66)); });
+        report(log, "ray::at", [this](int i) { out[i] = ray(a[i], b[i]).at(real(i)); });
+
+        // Printed so the compiler cannot drop the loops as dead code.
+        log << "checksum " << checksum() << '\n';
+    }
+
+private:
+    std::vector<vec3> a;
+    std::vector<vec3> b;
+    std::vector<vec3> out;
+
+    template <typename Op>
+    void report(std::ostream& log, const char* name, Op op)
+    {
+        double best = 0;
+        for (int r = 0; r < repetitions; ++r)
+        {
+            auto start = std::chrono::steady_clock::now();
+            for (int p = 0; p < passes; ++p)
+            {
+                for (int i = 0; i < count; ++i)
+                    op(i);
+                // Feed a result back so successive passes depend on each other.
+                a[p % count] += real(1e-6) * out[count - 1 - p % count];
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+            best = r == 0 || elapsed.count() < best ? elapsed.count() : best;
+        }
+
+        double ns = 1e9 * best / (static_cast<double>(passes) * count);
+        log << "  " << std::left << std::setw(14) << name << std::right << std::fixed << std::setprecision(2)
+            << std::setw(8) << ns << " ns/op\n";
+        log.unsetf(std::ios_base::floatfield);
+    }
+
+    double checksum() const
+    {
+        double sum = 0;
+        for (const vec3& v : out)
+            sum += v.x() + v.y() + v.z();
+        return sum;
+    }
+};
+
+#endif // !VEC3_BENCH_H
@@ -0,0 +1,120 @@
+#ifndef VEC3_SIMD_H
+#define VEC3_SIMD_H
+
+#include "cpu_features.h"
+#include "precision.h"
+
+// Optional vector-register implementation of vec3. With RT_SIMD_VEC3 1 a vec3 is padded to four
+// lanes and its arithmetic is done with one instruction per operation instead of three: SSE for
+// float, AVX2 for double when the compiler targets it (/arch:AVX2, -mavx2), and pairs of SSE2
+// registers for double otherwise. Unlike the kernels in cpu_features.h this is chosen when
+// compiling, since a runtime switch per vector operation would cost more than it saves.
+//
+// Lane 3 is padding. Operations may leave anything in it and nothing reads it, so results are
+// bit-identical to the scalar vec3. Loads and stores are unaligned: heap objects are only
+// guaranteed 16 (or, on 32-bit targets, 8) byte alignment before C++17, and unaligned loads of
+// aligned data cost nothing extra.
+#ifndef RT_SIMD_VEC3
+#define RT_SIMD_VEC3 0
+#endif
+
+#if RT_SIMD_VEC3 && !RT_X86
+#undef RT_SIMD_VEC3
+#define RT_SIMD_VEC3 0
+#endif
+
+#if RT_SIMD_VEC3
+
+class simd4
+{
+public:
+#if RT_SINGLE_PRECISION
+    using reg = __m128;
+
+    static reg load(const float* p) { return _mm_loadu_ps(p); }
+    static void store(float* p, reg a) { _mm_storeu_ps(p, a); }
+    static reg set(float x, float y, float z) { return _mm_set_ps(0, z, y, x); }
+    static reg set1(float t) { return _mm_set1_ps(t); }
+    static reg add(reg a, reg b) { return _mm_add_ps(a, b); }
+    static reg sub(reg a, reg b) { return _mm_sub_ps(a, b); }
+    static reg mul(reg a, reg b) { return _mm_mul_ps(a, b); }
+    static reg negate(reg a) { return _mm_xor_ps(a, _mm_set1_ps(-0.0f)); }
+    static reg yzx(reg a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1)); }
+    static reg zxy(reg a) { return _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 1, 0, 2)); }
+
+    static float sum3(reg a)
+    {
+        // (x + y) + z, the order the scalar dot product adds in.
+        __m128 s = _mm_add_ss(a, _mm_shuffle_ps(a, a, _MM_SHUFFLE(1, 1, 1, 1)));
+        return _mm_cvtss_f32(_mm_add_ss(s, _mm_movehl_ps(a, a)));
+    }
+
+    static const char* name() { return "SSE float x4"; }
+#elif defined(__AVX2__)
+    using reg = __m256d;
+
+    static reg load(const double* p) { return _mm256_loadu_pd(p); }
+    static void store(double* p, reg a) { _mm256_storeu_pd(p, a); }
+    static reg set(double x, double y, double z) { return _mm256_set_pd(0, z, y, x); }
+    static reg set1(double t) { return _mm256_set1_pd(t); }
+    static reg add(reg a, reg b) { return _mm256_add_pd(a, b); }
+    static reg sub(reg a, reg b) { return _mm256_sub_pd(a, b); }
+    static reg mul(reg a, reg b) { return _mm256_mul_pd(a, b); }
+    static reg negate(reg a) { return _mm256_xor_pd(a, _mm256_set1_pd(-0.0)); }
+    static reg yzx(reg a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 0, 2, 1)); }
+    static reg zxy(reg a) { return _mm256_permute4x64_pd(a, _MM_SHUFFLE(3, 1, 0, 2)); }
+
+    static double sum3(reg a)
+    {
+        __m128d xy = _mm256_castpd256_pd128(a);
+        __m128d s = _mm_add_sd(xy, _mm_unpackhi_pd(xy, xy));
+        return _mm_cvtsd_f64(_mm_add_sd(s, _mm256_extractf128_pd(a, 1)));
+    }
+
+    static const char* name() { return "AVX2 double x4"; }
+#else
+    class reg
+    {
+    public:
+        __m128d xy, zw;
+    };
+
+    static reg load(const double* p) { return { _mm_loadu_pd(p), _mm_loadu_pd(p + 2) }; }
+    static void store(double* p, reg a) { _mm_storeu_pd(p, a.xy); _mm_storeu_pd(p + 2, a.zw); }
+    static reg set(double x, double y, double z) { return { _mm_set_pd(y, x), _mm_set_pd(0, z) }; }
+    static reg set1(double t) { return { _mm_set1_pd(t), _mm_set1_pd(t) }; }
+    static reg add(reg a, reg b) { return { _mm_add_pd(a.xy, b.xy), _mm_add_pd(a.zw, b.zw) }; }
+    static reg sub(reg a, reg b) { return { _mm_sub_pd(a.xy, b.xy), _mm_sub_pd(a.zw, b.zw) }; }
+    static reg mul(reg a, reg b) { return { _mm_mul_pd(a.xy, b.xy), _mm_mul_pd(a.zw, b.zw) }; }
+
+    static reg negate(reg a)
+    {
+        __m128d sign = _mm_set1_pd(-0.0);
+        return { _mm_xor_pd(a.xy, sign), _mm_xor_pd(a.zw, sign) };
+    }
+
+    static reg yzx(reg a) { return { _mm_shuffle_pd(a.xy, a.zw, 1), _mm_shuffle_pd(a.xy, a.zw, 2) }; }
+    static reg zxy(reg a) { return { _mm_shuffle_pd(a.zw, a.xy, 0), _mm_shuffle_pd(a.xy, a.zw, 3) }; }
+
+    static double sum3(reg a)
+    {
+        __m128d s = _mm_add_sd(a.xy, _mm_unpackhi_pd(a.xy, a.xy));
+        return _mm_cvtsd_f64(_mm_add_sd(s, a.zw));
+    }
+
+    static const char* name() { return "SSE2 double x2x2"; }
+#endif
+};
+
+#endif
+
+inline const char* vec3_backend_name()
+{
+#if RT_SIMD_VEC3
+    return simd4::name();
+#else
+    return sizeof(real) == sizeof(float) ? "scalar float" : "scalar double";
+#endif
+}
+
+#endif // !VEC3_SIMD_H